@@ -1,6 +1,16 @@
 #!/usr/bin/env python3
 
-import sys, os, re, zstd
+import sys, os, re, zstandard
+
+# Each file is its own zstd frame, so the engine can unpack files one at a
+# time as they're opened. Small files compress poorly alone, so the frames
+# share a dictionary trained on all of them.
+DICT_SIZE = 16 * 1024
+SAMPLE_SIZE = 4096
+
+# Seeds to try for each bucket before giving up. With a well-mixed hash,
+# real buckets need a handful.
+MAX_SEED = 1 << 16
 
 
 def collect_files(in_dir):
@@ -17,15 +27,104 @@ def varname_for_file(name):
     return "file_%s" % name.lower().replace(".", "_")
 
 
-def combine_files(fs):
+def train_dictionary(fs):
+    # Slicing files up gives the trainer enough samples to work with
+    samples = []
+    for name in sorted(fs.keys()):
+        data = fs[name]
+        for offset in range(0, len(data), SAMPLE_SIZE):
+            samples.append(data[offset : offset + SAMPLE_SIZE])
+    try:
+        return zstandard.train_dictionary(DICT_SIZE, samples, level=22).as_bytes()
+    except zstandard.ZstdError:
+        return b""
+
+
+def compress_files(fs, dictionary):
+    params = dict(
+        level=22, write_content_size=False, write_checksum=False, write_dict_id=False
+    )
+    if dictionary:
+        params["dict_data"] = zstandard.ZstdCompressionDict(
+            dictionary, dict_type=zstandard.DICT_TYPE_FULLDICT
+        )
+    cctx = zstandard.ZstdCompressor(**params)
+
     index = []
     blob = b""
     for name in sorted(fs.keys()):
-        index.append('\t{ "%s", %d, %d },' % (name, len(blob), len(fs[name])))
-        blob += fs[name]
+        frame = cctx.compress(fs[name])
+        index.append((name, len(blob), len(frame), len(fs[name])))
+        blob += frame
     return (index, blob)
 
 
+def pack_files(fs):
+    # Only keep the dictionary if it pays for itself
+    dictionary = train_dictionary(fs)
+    index, blob = compress_files(fs, dictionary)
+    plain_index, plain_blob = compress_files(fs, b"")
+    if len(plain_blob) <= len(blob) + len(dictionary):
+        return (plain_index, plain_blob, b"")
+    return (index, blob, dictionary)
+
+
+def hash_name(seed, name):
+    # Must match CompressedFileInfo::hashName()
+    h = seed or 0x01000193
+    for c in name.upper().encode():
+        h = ((h * 0x01000193) ^ c) & 0xFFFFFFFF
+
+    # FNV alone leaves names that differ only in their first letters
+    # differing only in high bits. A seed never changes the result mod n
+    # for those, so finish with MurmurHash3's fmix32.
+    h ^= h >> 16
+    h = (h * 0x85EBCA6B) & 0xFFFFFFFF
+    h ^= h >> 13
+    h = (h * 0xC2B2AE35) & 0xFFFFFFFF
+    h ^= h >> 16
+    return h
+
+
+def perfect_hash(names):
+    # Minimal perfect hash, by hash and displace. Names are bucketed by an
+    # unseeded hash. Each bucket with several names gets a seed that sends
+    # all of them to free slots. Buckets with one name point straight at a
+    # slot instead, stored as -1 - slot.
+    n = len(names)
+    buckets = [[] for _ in range(n)]
+    for i, name in enumerate(names):
+        buckets[hash_name(0, name) % n].append(i)
+
+    table = [0] * n
+    slots = [None] * n
+    for bucket in sorted(buckets, key=len, reverse=True):
+        if len(bucket) <= 1:
+            break
+        for seed in range(1, MAX_SEED):
+            placed = [hash_name(seed, names[i]) % n for i in bucket]
+            if len(set(placed)) == len(placed) and all(
+                slots[s] is None for s in placed
+            ):
+                break
+        else:
+            raise ValueError(
+                "No perfect hash seed for %s"
+                % ", ".join(names[i] for i in bucket)
+            )
+        table[hash_name(0, names[bucket[0]]) % n] = seed
+        for i, s in zip(bucket, placed):
+            slots[s] = i
+
+    free = [s for s in range(n) if slots[s] is None]
+    for bucket in buckets:
+        if len(bucket) == 1:
+            s = free.pop()
+            table[hash_name(0, names[bucket[0]]) % n] = -1 - s
+            slots[s] = bucket[0]
+    return (table, slots)
+
+
 def to_hex(seq):
     return "".join(
         ["0x%02x,%s" % (b, "\n"[: (i & 15) == 15]) for i, b in enumerate(seq)]
@@ -41,36 +140,59 @@ def write_header(cpp):
     )
 
 
-def write_blob(cpp, blob):
-    compressed = zstd.compress(blob, 22)
-    cpp.write("\nstatic const uint8_t fs_pack[] = {\n%s\n};\n" % (to_hex(compressed),))
-    cpp.write("static uint8_t fs_unpacked[%d];\n" % len(blob))
+def write_blob(cpp, blob, dictionary):
+    cpp.write("\nstatic const uint8_t fs_pack[] = {\n%s\n};\n" % (to_hex(blob),))
+    cpp.write(
+        "static const uint8_t fs_dict[] = {\n%s\n};\n" % (to_hex(dictionary or b"\0"),)
+    )
     cpp.write("const uint8_t* const CompressedFileInfo::packed = fs_pack;\n")
-    cpp.write("uint8_t* const CompressedFileInfo::unpacked = fs_unpacked;\n")
+    cpp.write("const uint8_t* const CompressedFileInfo::dictionary = fs_dict;\n")
     cpp.write(
-        "const uint32_t CompressedFileInfo::packed_size = %d;\n" % len(compressed)
+        "const uint32_t CompressedFileInfo::dictionary_size = %d;\n" % len(dictionary)
     )
-    cpp.write("const uint32_t CompressedFileInfo::unpacked_size = %d;\n" % len(blob))
 
 
 def write_index(cpp, index):
     cpp.write(
-        "\nstatic const CompressedFileInfo fs_index[%d] = {\n%s\n\t{nullptr, 0, 0}\n};\n"
+        "\nstatic const CompressedFileInfo fs_index[%d] = {\n%s\n\t{nullptr, 0, 0, 0}\n};\n"
         % (
             len(index) + 1,
-            "\n".join(index),
+            "\n".join(['\t{ "%s", %d, %d, %d },' % item for item in index]),
         )
     )
-    cpp.write("static FileInfo fs_cache[%d];\n" % (len(index) + 1,))
+    cpp.write(
+        "static FileInfo fs_cache[%d] = {\n%s\n\t{nullptr, nullptr, 0}\n};\n"
+        % (
+            len(index) + 1,
+            "\n".join(
+                [
+                    '\t{ "%s", nullptr, %d },' % (name, size)
+                    for name, _, _, size in index
+                ]
+            ),
+        )
+    )
+    table, slots = perfect_hash([name for name, _, _, _ in index])
+    cpp.write(
+        "static const int32_t fs_hash[] = {%s};\n"
+        % ", ".join(map(str, table or [0]))
+    )
+    cpp.write(
+        "static const uint16_t fs_slots[] = {%s};\n"
+        % ", ".join(map(str, slots or [0]))
+    )
+    cpp.write("const int32_t* const CompressedFileInfo::hash_table = fs_hash;\n")
+    cpp.write("const uint16_t* const CompressedFileInfo::hash_slots = fs_slots;\n")
     cpp.write("const CompressedFileInfo* const CompressedFileInfo::index = fs_index;\n")
     cpp.write("FileInfo* const CompressedFileInfo::cache = fs_cache;\n")
+    cpp.write("const uint32_t CompressedFileInfo::count = %d;\n" % len(index))
 
 
 def main(in_dir, out_file):
     cpp = open(out_file, "w")
     write_header(cpp)
-    index, blob = combine_files(collect_files(in_dir))
-    write_blob(cpp, blob)
+    index, blob, dictionary = pack_files(collect_files(in_dir))
+    write_blob(cpp, blob, dictionary)
     write_index(cpp, index)
     cpp.close()
 
@@ -0,0 +1,223 @@
+#include "batchHost.h"
+#include <algorithm>
+#include <emscripten.h>
+#include <stdio.h>
+
+// Emscripten only has working threads when built with -pthread
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#define BATCH_HOST_THREADS 1
+#include <thread>
+#else
+#define BATCH_HOST_THREADS 0
+#endif
+
+SBT_DECL_PROCESS(ShowEXE);
+SBT_DECL_PROCESS(Show2EXE);
+SBT_DECL_PROCESS(LabEXE);
+SBT_DECL_PROCESS(GameEXE);
+SBT_DECL_PROCESS(TutorialEXE);
+
+struct BatchHost::Instance {
+    OutputInterface output;
+    Hardware hw;
+
+    // Every process, so movies can exec anything. Data images are shared,
+    // so each of these only costs its locals.
+    ShowEXE show;
+    Show2EXE show2;
+    LabEXE lab;
+    GameEXE game;
+    TutorialEXE tutorial;
+
+    MoviePlayer *movie;
+    StateHasher *hasher;
+
+    // Only touched by the worker currently holding this instance's task
+    unsigned frames_left;
+    uint64_t frames_run;
+
+    Instance(ColorTable &colorTable)
+        : output(colorTable), hw(output), show(&hw), show2(&hw), lab(&hw),
+          game(&hw), tutorial(&hw), movie(nullptr), hasher(nullptr),
+          frames_left(0), frames_run(0) {}
+
+    bool isRunnable() {
+        return movie ? !movie->isFinished() : hw.process != nullptr;
+    }
+};
+
+BatchHost::BatchHost(ColorTable &colorTable)
+    : colorTable(colorTable), unfinished(0), total_frames(0) {}
+
+BatchHost::~BatchHost() {}
+
+unsigned BatchHost::addInstance(const char *program, const char *args) {
+    instances.emplace_back(new Instance(colorTable));
+    instances.back()->hw.exec(program, args);
+    return instances.size() - 1;
+}
+
+Hardware &BatchHost::getInstance(unsigned index) {
+    assert(index < instances.size());
+    return instances[index]->hw;
+}
+
+void BatchHost::setMovie(unsigned index, MoviePlayer *movie) {
+    assert(index < instances.size());
+    Instance &inst = *instances[index];
+    inst.movie = movie;
+    if (movie) {
+        movie->start(inst.hw);
+    }
+}
+
+void BatchHost::setStateHasher(unsigned index, StateHasher *hasher) {
+    assert(index < instances.size());
+    instances[index]->hasher = hasher;
+}
+
+unsigned BatchHost::getMaxThreads() {
+#if BATCH_HOST_THREADS
+    return std::max(1u, std::thread::hardware_concurrency());
+#else
+    return 1;
+#endif
+}
+
+double BatchHost::run(unsigned frames, unsigned threads) {
+    threads = std::max(1u, std::min(threads, getMaxThreads()));
+    if (instances.empty() || frames == 0) {
+        return 0.0;
+    }
+
+    workers.clear();
+    for (unsigned i = 0; i < threads; i++) {
+        workers.emplace_back(new Worker);
+    }
+
+    // Deal out instances round-robin; busy workers get robbed later
+    unsigned count = 0;
+    for (unsigned i = 0; i < instances.size(); i++) {
+        Instance &inst = *instances[i];
+        inst.frames_left = inst.isRunnable() ? frames : 0;
+        inst.frames_run = 0;
+        if (inst.frames_left) {
+            workers[i % threads]->tasks.push_back(i);
+            count++;
+        }
+    }
+    unfinished = count;
+
+    double start = emscripten_get_now();
+#if BATCH_HOST_THREADS
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++) {
+        pool.emplace_back(&BatchHost::work, this, i);
+    }
+    work(0);
+    for (std::thread &t : pool) {
+        t.join();
+    }
+#else
+    work(0);
+#endif
+    double msec = emscripten_get_now() - start;
+
+    uint64_t frames_run = 0;
+    for (const std::unique_ptr<Instance> &inst : instances) {
+        frames_run += inst->frames_run;
+    }
+    total_frames += frames_run;
+    workers.clear();
+
+    return msec > 0.0 ? frames_run * 1000.0 / msec : 0.0;
+}
+
+void BatchHost::work(unsigned id) {
+    // Tasks stay with the worker that last ran them, so an instance tends to
+    // keep running on the same core. Idle workers steal from the front of
+    // other queues, taking the instances furthest from their owner's cache.
+    while (unfinished) {
+        unsigned task;
+        if (!takeTask(id, task)) {
+#if BATCH_HOST_THREADS
+            std::this_thread::yield();
+#endif
+            continue;
+        }
+        if (runTask(task)) {
+            Worker &self = *workers[id];
+            std::lock_guard<std::mutex> guard(self.lock);
+            self.tasks.push_back(task);
+        } else {
+            unfinished--;
+        }
+    }
+}
+
+bool BatchHost::takeTask(unsigned id, unsigned &task) {
+    {
+        Worker &self = *workers[id];
+        std::lock_guard<std::mutex> guard(self.lock);
+        if (!self.tasks.empty()) {
+            task = self.tasks.back();
+            self.tasks.pop_back();
+            return true;
+        }
+    }
+    for (unsigned i = 1; i < workers.size(); i++) {
+        Worker &victim = *workers[(id + i) % workers.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BatchHost::runTask(unsigned task) {
+    // Advance one instance by one presented frame. Returns true if it has
+    // more frames to go.
+    Instance &inst = *instances[task];
+    const uint32_t frame_count = inst.output.getFrameCount();
+
+    while (inst.output.getFrameCount() == frame_count) {
+        if (inst.movie) {
+            if (!inst.movie->step(inst.hw)) {
+                return false;
+            }
+        } else if (inst.hw.process) {
+            inst.hw.process->run();
+        } else {
+            return false;
+        }
+    }
+    if (inst.hasher) {
+        inst.hasher->push(inst.hw);
+    }
+    inst.frames_run++;
+    return --inst.frames_left > 0;
+}
+
+void BatchHost::benchmark(ColorTable &colorTable, unsigned instances,
+                          unsigned frames) {
+    BatchHost host(colorTable);
+    for (unsigned i = 0; i < instances; i++) {
+        host.addInstance("game.exe");
+    }
+
+    // Get past startup first, so every pass measures the same kind of frames
+    host.run(1, getMaxThreads());
+
+    for (unsigned threads = 1;; threads *= 2) {
+        threads = std::min(threads, getMaxThreads());
+        double fps = host.run(frames, threads);
+        printf("BATCH, %d instances on %d threads: %.1f frames/sec\n",
+               instances, threads, fps);
+        if (threads == getMaxThreads()) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "draw.h"
+#include "hardware.h"
+#include "inputMovie.h"
+#include "stateHash.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+// Runs many independent game instances side by side, for automated
+// playtesting and movie replay. Each instance has its own Hardware,
+// OutputInterface, and translated processes. They share only read-only data:
+// the unpacked file pack, the EXE data images, and the color table.
+//
+// Instances are advanced one frame per task, on a small work-stealing thread
+// pool. Without thread support (a wasm build without pthreads) everything
+// runs on the calling thread instead.
+class BatchHost {
+  public:
+    BatchHost(ColorTable &colorTable);
+    ~BatchHost();
+
+    // Start a new instance running 'program' (or nothing, if it's empty),
+    // returning its index
+    unsigned addInstance(const char *program, const char *args = "");
+
+    // Instances can be inspected or given input between calls to run()
+    Hardware &getInstance(unsigned index);
+    unsigned getInstanceCount() const { return instances.size(); }
+
+    // Drive an instance from a recorded movie instead of leaving it idle.
+    // The player is prepared here, and must outlive any run() that uses it.
+    // The instance finishes when the movie does.
+    void setMovie(unsigned index, MoviePlayer *movie);
+
+    // Push a state digest after every frame an instance runs, or nullptr
+    void setStateHasher(unsigned index, StateHasher *hasher);
+
+    // Run each instance for up to 'frames' more presented frames, stopping
+    // early if its process exits or its movie ends. Returns aggregate frames
+    // per second.
+    double run(unsigned frames, unsigned threads);
+
+    uint64_t getTotalFrames() const { return total_frames; }
+
+    // Worker threads available here; 1 when there's no thread support
+    static unsigned getMaxThreads();
+
+    // Log frames per second for 'instances' copies of game.exe, at each
+    // power-of-two thread count up to the maximum
+    static void benchmark(ColorTable &colorTable, unsigned instances,
+                          unsigned frames);
+
+  private:
+    struct Instance;
+
+    struct Worker {
+        std::mutex lock;
+        std::deque<unsigned> tasks;
+    };
+
+    ColorTable &colorTable;
+    std::vector<std::unique_ptr<Instance>> instances;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<unsigned> unfinished;
+    uint64_t total_frames;
+
+    void work(unsigned id);
+    bool takeTask(unsigned id, unsigned &task);
+    bool runTask(unsigned task);
+};
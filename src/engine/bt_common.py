@@ -182,18 +182,17 @@ def patch(b):
 def patchFramebufferTrace(b, interval=512):
     # Trace the framebuffer to emit frames periodically during animated transitions
     b.decl("#include <stdio.h>")
-    b.decl("static bool enable_framebuffer_trace;")
+    b.local("bool enable_framebuffer_trace;")
+    b.local("uint32_t framebuffer_trace_hits;")
     b.trace(
         "w",
         """
        return segment == 0xB800;
     """,
         """
-        if (enable_framebuffer_trace) {
-            static uint32_t hit = 0;
-            hit++;
-            if (hit == %d) {
-                hit = 0;
+        if (g.enable_framebuffer_trace) {
+            if (++g.framebuffer_trace_hits == %d) {
+                g.framebuffer_trace_hits = 0;
                 g.hw->output.pushFrameCGA(g.clock, g.stack, g.proc->memSeg(0xB800));
             }
         }
@@ -214,9 +213,40 @@ def patchChips(b):
         b.findCode("e9c000 :8a9d____ b700 d1e3 8b87____" "86e0 260b84fefe 268984fefe"),
         192,
     )
-    b.patchDynamicLiteral(b.findCode(":b200 32f6 8bfa 8b1e____ 8a01 3c07"), 896)
+    simulateOneChip = b.findCode(":b200 32f6 8bfa 8b1e____ 8a01 3c07")
+    b.patchDynamicLiteral(simulateOneChip, 896)
     b.patchDynamicLiteral(b.findCode("8a01 :a2____ 8ad0 32f6 8bfa 8a85____"), 3)
 
+    # That first block is simulate_one_chip, which runs the bytecode for one
+    # chip and every chip nested in it. ChipSim can run the chip natively
+    # instead, or run both and compare. The block also reads
+    # current_bytecode_ptr, which starts just past the chip's 8 pin bytes.
+    # While a check runs the translated routine from inside this hook,
+    # chipsim_busy lets it through, including any jumps back to the top.
+
+    bytecodePtr = b.peek16(simulateOneChip.add(8))
+    b.markSubroutine(simulateOneChip)
+    b.local("bool chipsim_busy;")
+    b.hook(
+        simulateOneChip,
+        """
+        if (g.hw->chips.getMode() != CHIP_SIM_TRANSLATED && !g.chipsim_busy) {
+            uint16_t chip = read16(g.s.ds + 0x%04x) - ChipSim::PIN_COUNT;
+            if (g.hw->chips.begin(*g.hw, g.s.ds, chip)) {
+                goto ret;
+            }
+            if (g.hw->chips.getMode() == CHIP_SIM_CHECK) {
+                g.chipsim_busy = true;
+                sub_%X();
+                g.chipsim_busy = false;
+                g.hw->chips.end(g.s.ds, chip);
+                goto ret;
+            }
+        }
+    """
+        % (bytecodePtr, simulateOneChip.linear),
+    )
+
     # The chip simulator uses the stack in an interesting way... Any
     # time there is a gate simulation result which can't be written
     # immediately (it affects other gates, not just pins) it's added
@@ -288,8 +318,16 @@ def patchLoadSave(b):
             r.bx = 0x%04x;
             strcpy((char*)g.s.ds + 0x%04x, filename);
             strcpy((char*)g.s.ds + 0x%04x, filename);
+            g.hw->markDirty(g.s.ds + 0x%04x - g.hw->mem, strlen(filename) + 1);
+            g.hw->markDirty(g.s.ds + 0x%04x - g.hw->mem, strlen(filename) + 1);
         """
-            % (saveFilenameAddr, saveFilenameAddr, loadFilenameAddr),
+            % (
+                saveFilenameAddr,
+                saveFilenameAddr,
+                loadFilenameAddr,
+                saveFilenameAddr,
+                loadFilenameAddr,
+            ),
         )
 
     # Find the code for the menu that asks you to press "S" to save.
@@ -351,7 +389,7 @@ def patchJoystick(b, map_active_addr=-1):
             }} else {{
                 g.hw->input.updateMouse(world);
             }}
-            g.hw->input.pollJoystick(r.bx, r.cx, g.proc->memSeg(r.ds)[{buttons}]);
+            g.hw->input.pollJoystick(r.bx, r.cx, *g.hw->markDirty(g.proc->memSeg(r.ds) + {buttons}));
         }}
     """,
     )
@@ -368,14 +406,14 @@ def patchVideoBlit(b, code, map_active_addr=-1):
     # When we are in the master computer center map, set a longer frame delay here.
     # (Delaying in map-specific code before rendering would increase latency.)
 
-    b.decl("static bool noBlit = false;")
+    b.local("bool noBlit;")
     b.patchAndHook(
         b.findCode(
             ":803e____01 7503 e95a05 c43e____" "bb2800 a1____ 8cda 8ed8 be0020 33 c0"
         ),
         "ret",
         f"""
-        if (!noBlit) {{
+        if (!g.noBlit) {{
             {code}
             {{
                 uint8_t map_active = {map_active_addr} > 0 ? g.s.ds[(uint16_t){map_active_addr}] : 0;
@@ -397,11 +435,11 @@ def patchVideoBlit(b, code, map_active_addr=-1):
 
     b.hook(
         b.findCode("c3 :e8____ b500 b100 8bf9 8a85ac05 a2____" "e8____ e8____ c3"),
-        "noBlit = true;",
+        "g.noBlit = true;",
     )
     b.hook(
         b.findCode("c3 e8____: b500 b100 8bf9 8a85ac05 a2____" "e8____ e8____ c3"),
-        "noBlit = false;",
+        "g.noBlit = false;",
     )
 
 
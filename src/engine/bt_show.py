@@ -22,7 +22,7 @@ b.decl("#include <string.h>")
 
 bt_common.patchJoystick(b)
 bt_common.patchFramebufferTrace(b)
-b.hook(b.entryPoint, "enable_framebuffer_trace = true;")
+b.hook(b.entryPoint, "g.enable_framebuffer_trace = true;")
 
 # Go directly to the new-game cutscene after we get the SHW file reader setup
 b.patch("019E:00F8", "jmp 0x1A6")
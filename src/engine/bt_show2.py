@@ -22,7 +22,7 @@ b.basename = "show2.exe"
 
 bt_common.patchJoystick(b)
 bt_common.patchFramebufferTrace(b)
-b.hook(b.entryPoint, "enable_framebuffer_trace = true;")
+b.hook(b.entryPoint, "g.enable_framebuffer_trace = true;")
 
 # Time everything in this EXE, not just sound subroutines
 sbt86.Subroutine.clockEnable = True
@@ -0,0 +1,335 @@
+#include "chipSim.h"
+#include "hardware.h"
+#include <string.h>
+
+ChipSim::ChipSim() : next_program(0) { setMode(CHIP_SIM_TRANSLATED); }
+
+void ChipSim::setMode(ChipSimMode mode) {
+    this->mode = mode;
+    memset(&stats, 0, sizeof stats);
+    stats.first_chip = -1;
+    stats.first_byte = -1;
+    check_chip = -1;
+}
+
+bool ChipSim::begin(Hardware &hw, uint8_t *ds, uint16_t chip) {
+    check_chip = -1;
+    if (mode == CHIP_SIM_TRANSLATED) {
+        return false;
+    }
+    const Program *p = program(ds, chip);
+    if (!p) {
+        stats.fallbacks++;
+        return false;
+    }
+
+    if (mode == CHIP_SIM_CHECK) {
+        // The translated code runs on memory next, and end() compares
+        memcpy(check_result, ds + chip, CHIP_SIZE);
+        execute(*p, check_result);
+        check_chip = chip;
+        return false;
+    }
+
+    execute(*p, ds + chip);
+    hw.markDirty(uint32_t(ds + chip - hw.mem), CHIP_SIZE);
+    stats.passes++;
+    return true;
+}
+
+void ChipSim::end(const uint8_t *ds, uint16_t chip) {
+    if (check_chip != chip) {
+        return;
+    }
+    check_chip = -1;
+    stats.passes++;
+
+    const uint8_t *bytes = ds + chip;
+    for (unsigned i = 0; i < CHIP_SIZE; i++) {
+        if (bytes[i] != check_result[i]) {
+            if (stats.mismatches++ == 0) {
+                stats.first_chip = chip;
+                stats.first_byte = i;
+            }
+            break;
+        }
+    }
+}
+
+const ChipSim::Program *ChipSim::program(const uint8_t *ds, uint16_t chip) {
+    // Chips that would wrap around the segment are left to translated code
+    if (unsigned(chip) + CHIP_SIZE > 0x10000) {
+        return nullptr;
+    }
+    const uint8_t *bytes = ds + chip;
+
+    Program *p = nullptr;
+    for (Program &candidate : programs) {
+        if (candidate.chip == chip) {
+            p = &candidate;
+            break;
+        }
+    }
+
+    // Only the bytecode has to match. Values change on every pass.
+    if (p && p->valid) {
+        uint8_t diff = 0;
+        for (unsigned i = 0; i < p->length; i++) {
+            diff |= (bytes[i] ^ p->image[i]) & p->structure[i];
+        }
+        if (!diff) {
+            return p;
+        }
+    }
+
+    if (!p) {
+        if (programs.size() < MAX_PROGRAMS) {
+            programs.emplace_back();
+            p = &programs.back();
+        } else {
+            p = &programs[next_program];
+            next_program = (next_program + 1) % MAX_PROGRAMS;
+        }
+        p->chip = chip;
+    }
+
+    stats.decodes++;
+    memcpy(p->image, bytes, CHIP_SIZE);
+    p->valid = decode(bytes, *p);
+    return p->valid ? p : nullptr;
+}
+
+bool ChipSim::decode(const uint8_t *chip, Program &p) {
+    // Follows the bytecode the way simulate_one_chip does, but only once.
+    // Nested chips disappear: their offsets are made relative to the outer
+    // chip, and each end of chip becomes its copies and a flush.
+    p.ops.clear();
+    p.dests.clear();
+    p.length = 0;
+    memset(p.structure, 0, sizeof p.structure);
+
+    unsigned bases[MAX_DEPTH];
+    unsigned depth = 0;
+    unsigned base = 0;
+    unsigned pc = PIN_COUNT;
+    bool done = false;
+
+    while (!done) {
+        if (pc >= CHIP_SIZE) {
+            return false;
+        }
+        p.structure[pc] = 0xFF;
+
+        Op op;
+        memset(&op, 0, sizeof op);
+        op.type = chip[pc];
+        op.dests = p.dests.size();
+
+        switch (op.type) {
+        case OP_AND:
+        case OP_OR:
+        case OP_XOR:
+            op.in[0] = pc + 1;
+            op.in[1] = pc + 2;
+            pc += 3;
+            if (!decodeList(chip, p, base, pc, false, op.count[0])) {
+                return false;
+            }
+            p.ops.push_back(op);
+            break;
+
+        case OP_NOT:
+            op.in[0] = pc + 1;
+            op.in[1] = pc + 1;
+            pc += 2;
+            if (!decodeList(chip, p, base, pc, false, op.count[0])) {
+                return false;
+            }
+            p.ops.push_back(op);
+            break;
+
+        case OP_FLIPFLOP:
+            op.in[0] = pc + 1;
+            op.in[1] = pc + 2;
+            op.state[0] = pc + 3;
+            op.state[1] = pc + 4;
+            pc += 5;
+            if (!decodeList(chip, p, base, pc, false, op.count[0]) ||
+                !decodeList(chip, p, base, pc, false, op.count[1])) {
+                return false;
+            }
+            p.ops.push_back(op);
+            break;
+
+        case 0x06:
+            // Nested chip, pin state first. The game's stack holds the
+            // outermost chip too.
+            if (depth + 1 >= MAX_DEPTH) {
+                return false;
+            }
+            bases[depth++] = base;
+            base = pc + 1;
+            pc = base + PIN_COUNT;
+            break;
+
+        case 0x07:
+            for (pc++;;) {
+                if (pc >= CHIP_SIZE) {
+                    return false;
+                }
+                p.structure[pc] = 0xFF;
+                if (chip[pc] == 0xFF) {
+                    pc++;
+                    break;
+                }
+                if (pc + 1 >= CHIP_SIZE) {
+                    return false;
+                }
+                p.structure[pc + 1] = 0xFF;
+
+                const unsigned source = base + (chip[pc] << 8 | chip[pc + 1]);
+                Op copy;
+                memset(&copy, 0, sizeof copy);
+                copy.type = OP_COPY;
+                copy.in[0] = source;
+                copy.dests = p.dests.size();
+                pc += 2;
+                if (source >= CHIP_SIZE ||
+                    !decodeList(chip, p, base, pc, true, copy.count[0])) {
+                    return false;
+                }
+                p.ops.push_back(copy);
+            }
+            op.type = OP_FLUSH;
+            p.ops.push_back(op);
+
+            if (depth == 0) {
+                p.length = pc;
+                done = true;
+            } else {
+                base = bases[--depth];
+            }
+            break;
+
+        default:
+            pc++;
+            break;
+        }
+    }
+
+    // Operands that run off the end, and anything that writes over bytecode,
+    // would change what the translated code does partway through a pass
+    for (const Op &op : p.ops) {
+        for (unsigned i = 0; i < 2; i++) {
+            if (op.in[i] >= CHIP_SIZE || op.state[i] >= CHIP_SIZE) {
+                return false;
+            }
+        }
+        if (op.type == OP_FLIPFLOP &&
+            (p.structure[op.in[0]] || p.structure[op.in[1]] ||
+             p.structure[op.state[0]] || p.structure[op.state[1]])) {
+            return false;
+        }
+    }
+    for (uint16_t dest : p.dests) {
+        if (p.structure[dest & ~DEFERRED]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ChipSim::decodeList(const uint8_t *chip, Program &p, unsigned base,
+                         unsigned &pc, bool copy, uint16_t &count) {
+    // Gate results for anything but the current chip's pins wait for the end
+    // of the chip. Copies are always written right away.
+    count = 0;
+    for (;;) {
+        if (pc >= CHIP_SIZE) {
+            return false;
+        }
+        p.structure[pc] = 0xFF;
+        if (chip[pc] == 0xFF) {
+            pc++;
+            return true;
+        }
+        if (pc + 1 >= CHIP_SIZE) {
+            return false;
+        }
+        p.structure[pc + 1] = 0xFF;
+
+        const unsigned offset = chip[pc] << 8 | chip[pc + 1];
+        pc += 2;
+        if (base + offset >= CHIP_SIZE) {
+            return false;
+        }
+        uint16_t dest = base + offset;
+        if (!copy && offset >= PIN_COUNT) {
+            dest |= DEFERRED;
+        }
+        p.dests.push_back(dest);
+        count++;
+    }
+}
+
+void ChipSim::execute(const Program &p, uint8_t *chip) {
+    pending.clear();
+    for (const Op &op : p.ops) {
+        switch (op.type) {
+        case OP_AND:
+            store(p, op, 0, chip, chip[op.in[0]] & chip[op.in[1]]);
+            break;
+        case OP_OR:
+            store(p, op, 0, chip, chip[op.in[0]] | chip[op.in[1]]);
+            break;
+        case OP_XOR:
+            store(p, op, 0, chip, chip[op.in[0]] ^ chip[op.in[1]]);
+            break;
+        case OP_NOT:
+            store(p, op, 0, chip, (chip[op.in[0]] ^ 1) & 1);
+            break;
+
+        case OP_FLIPFLOP: {
+            // Inputs are cleared as they're read. One input alone toggles
+            // the flip-flop, unless its side is already on. Both or neither
+            // hold, unlike flip-flops outside chips.
+            const uint8_t set = chip[op.in[0]] & 1;
+            chip[op.in[0]] = 0;
+            const uint8_t reset = chip[op.in[1]] & 1;
+            chip[op.in[1]] = 0;
+            if (set != reset && !(chip[op.state[set ? 0 : 1]] & 1)) {
+                chip[op.state[0]] ^= 1;
+                chip[op.state[1]] ^= 1;
+            }
+            store(p, op, 0, chip, chip[op.state[0]]);
+            store(p, op, 1, chip, chip[op.state[1]]);
+            break;
+        }
+
+        case OP_COPY:
+            store(p, op, 0, chip, chip[op.in[0]]);
+            break;
+
+        case OP_FLUSH:
+            while (!pending.empty()) {
+                chip[pending.back().offset] = pending.back().value;
+                pending.pop_back();
+            }
+            break;
+        }
+    }
+}
+
+void ChipSim::store(const Program &p, const Op &op, unsigned output,
+                    uint8_t *chip, uint8_t value) {
+    const uint16_t *dest =
+        p.dests.data() + op.dests + (output ? op.count[0] : 0);
+    for (unsigned i = 0; i < op.count[output]; i++) {
+        if (dest[i] & DEFERRED) {
+            Pending w = {uint16_t(dest[i] & ~DEFERRED), value};
+            pending.push_back(w);
+        } else {
+            chip[dest[i]] = value;
+        }
+    }
+}
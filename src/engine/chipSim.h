@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+class Hardware;
+
+enum ChipSimMode {
+    CHIP_SIM_TRANSLATED,
+    CHIP_SIM_NATIVE,
+    CHIP_SIM_CHECK,
+};
+
+// Native simulator for compiled chips (ROChipBytecode), standing in for the
+// translated simulate_one_chip. That routine patches its own instructions
+// with the address of every value it reads or writes, so once translated,
+// every operand is a read through the code segment. Here each chip is
+// decoded once into a flat list of operations on fixed offsets, and decoded
+// again only when its bytecode changes, which is when a chip is loaded or
+// burned.
+//
+// From the names and comments in lab.exe.idc, a chip is 8 bytes of pin
+// state followed by bytecode:
+//
+//    01 a b list    AND          05 a b s0 s1 list list    flip-flop
+//    02 a b list    OR           06 pins bytecode          nested chip
+//    03 a b list    XOR          07 copies                 end of chip
+//    04 a list      NOT          anything else             skipped
+//
+// Gate inputs and flip-flop states are bytes in the bytecode itself. Each
+// list is FF-terminated big-endian offsets into the chip, for where the
+// result goes. Results for the chip's own pins are written right away. The
+// rest wait on a stack until the end of the chip and are written last in,
+// first out, so gates see each other's results from the previous pass.
+// The copies at the end of a chip are FF-terminated too, each a source
+// offset and a list.
+//
+// Memory stays the only copy of the circuit, so snapshots, saved games and
+// switching modes all keep working. Native mode doesn't update the
+// translated routine's own bookkeeping: its bytecode pointers, its nested
+// chip stack, and the instructions it patches.
+//
+// None of this could be checked against the original binaries when it was
+// written, so CHIP_SIM_CHECK runs both. The native pass runs on a copy of
+// the chip, the translated one on memory, and the two are compared. That
+// also confirms the hook's own assumption that one call to
+// simulate_one_chip runs one whole chip. Leave native mode off until a
+// check has passed on real lab sessions.
+class ChipSim {
+  public:
+    static const unsigned CHIP_SIZE = 1024;
+    static const unsigned PIN_COUNT = 8;
+    static const unsigned MAX_DEPTH = 40; // Size of the game's chip stack
+
+    struct Stats {
+        uint32_t passes;     // Chips run natively, or compared
+        uint32_t decodes;    // Chips decoded, including failures
+        uint32_t fallbacks;  // Chips left to the translated code
+        uint32_t mismatches; // Compared chips that came out different
+        int32_t first_chip;  // Data segment offset of the first mismatch
+        int32_t first_byte;  // and the first byte in it that differed
+    };
+
+    ChipSim();
+
+    // Also clears the stats
+    void setMode(ChipSimMode mode);
+    ChipSimMode getMode() const { return mode; }
+    const Stats &getStats() const { return stats; }
+
+    // Translated code calls this at the start of a chip, with the chip's
+    // offset in the data segment. Returns true if the chip was simulated
+    // here and the translated code should return.
+    bool begin(Hardware &hw, uint8_t *ds, uint16_t chip);
+
+    // In CHIP_SIM_CHECK, after the translated code has run the same chip
+    void end(const uint8_t *ds, uint16_t chip);
+
+  private:
+    enum OpType {
+        OP_AND = 1,
+        OP_OR = 2,
+        OP_XOR = 3,
+        OP_NOT = 4,
+        OP_FLIPFLOP = 5,
+        OP_COPY,  // One source from a chip's end, to a list
+        OP_FLUSH, // End of a chip, write everything waiting
+    };
+
+    // Destinations have this bit set if they wait for the end of the chip
+    static const uint16_t DEFERRED = 0x8000;
+
+    struct Op {
+        uint8_t type;
+        uint16_t in[2];    // Inputs, or the source for OP_COPY
+        uint16_t state[2]; // Flip-flop outputs
+        uint16_t dests;    // First entry in Program::dests
+        uint16_t count[2]; // Entries for each output
+    };
+
+    struct Program {
+        uint16_t chip; // Offset in the data segment
+        bool valid;
+        uint16_t length; // Bytes decoded, from the start of the chip
+        std::vector<Op> ops;
+        std::vector<uint16_t> dests;
+
+        // The chip as decoded, and 0xFF for each byte that's bytecode
+        // rather than a value. Those bytes have to stay the same.
+        uint8_t image[CHIP_SIZE];
+        uint8_t structure[CHIP_SIZE];
+
+        Program() : chip(0), valid(false), length(0) {}
+    };
+
+    struct Pending {
+        uint16_t offset;
+        uint8_t value;
+    };
+
+    static const unsigned MAX_PROGRAMS = 8;
+
+    ChipSimMode mode;
+    Stats stats;
+    std::vector<Program> programs;
+    unsigned next_program;
+    std::vector<Pending> pending;
+
+    // CHIP_SIM_CHECK: the chip after the native pass, waiting for end()
+    int32_t check_chip;
+    uint8_t check_result[CHIP_SIZE];
+
+    const Program *program(const uint8_t *ds, uint16_t chip);
+    bool decode(const uint8_t *chip, Program &p);
+    bool decodeList(const uint8_t *chip, Program &p, unsigned base,
+                    unsigned &pc, bool copy, uint16_t &count);
+    void execute(const Program &p, uint8_t *chip);
+    void store(const Program &p, const Op &op, unsigned output, uint8_t *chip,
+               uint8_t value);
+};
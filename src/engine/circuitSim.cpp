@@ -0,0 +1,271 @@
+#include "circuitSim.h"
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+// Lane L runs input combination L, so input N follows bit N of the lane
+// number. Inputs past these six are the same across a whole batch.
+static const CircuitSim::Lanes lane_patterns[] = {
+    0xAAAAAAAAAAAAAAAAull, 0xCCCCCCCCCCCCCCCCull, 0xF0F0F0F0F0F0F0F0ull,
+    0xFF00FF00FF00FF00ull, 0xFFFF0000FFFF0000ull, 0xFFFFFFFF00000000ull,
+};
+static const unsigned NUM_LANE_PATTERNS =
+    sizeof lane_patterns / sizeof lane_patterns[0];
+
+static bool isWired(uint8_t obj) {
+    // Unused wire slots are cleared, and the player is never wired up
+    return obj != RO_OBJ_NONE && obj != RO_OBJ_PLAYER;
+}
+
+static bool isChip(uint8_t obj) {
+    return obj >= RO_OBJ_CHIP_1 && obj <= RO_OBJ_CHIP_8;
+}
+
+CircuitSim::CircuitSim() {
+    memset(initial_ff, 0, sizeof initial_ff);
+    reset();
+}
+
+void CircuitSim::addWire(unsigned from, unsigned to) {
+    assert(from < NUM_SIGNALS && to < NUM_SIGNALS);
+    for (const Wire &w : wires) {
+        if (w.from == from && w.to == to) {
+            return;
+        }
+    }
+    Wire w = {uint16_t(from), uint16_t(to)};
+    wires.push_back(w);
+}
+
+void CircuitSim::load(const ROCircuit &circuit) {
+    wires.clear();
+    gates.clear();
+    flipflops.clear();
+
+    // Wires from ordinary objects: gate outputs, nodes, flip-flops, and
+    // robot parts. Wires into a chip don't say which pin they're on, and
+    // chips are opaque here anyway.
+    for (unsigned obj = 0; obj < 0x100; obj++) {
+        uint8_t to = circuit.obj_wires.output_obj[obj];
+        if (isWired(obj) && isWired(to) && !isChip(to)) {
+            addWire(obj, to);
+        }
+    }
+
+    // Nodes have a second output
+    for (unsigned i = 0; i < 15; i++) {
+        unsigned node = RO_OBJ_NODE_1 + i;
+        uint8_t from = circuit.node_wires.input_obj[i];
+        uint8_t to = circuit.node_wires.output2_obj[i];
+        if (isWired(from)) {
+            addWire(from, node);
+        }
+        if (isWired(to) && !isChip(to)) {
+            addWire(node, to);
+        }
+    }
+
+    // Wires from chip pins, possibly to other chip pins
+    for (unsigned i = 0; i < 64; i++) {
+        uint8_t to = circuit.chip_wires.output_obj[i];
+        uint8_t to_pin = circuit.chip_wires.output_pin[i];
+        if (!isWired(to)) {
+            continue;
+        }
+        if (isChip(to) && to_pin < 8) {
+            addWire(CHIP_PIN_BASE + i, chipPin(to - RO_OBJ_CHIP_1, to_pin));
+        } else if (!isChip(to)) {
+            addWire(CHIP_PIN_BASE + i, to);
+        }
+    }
+
+    // Gates use every third allocation slot, matching their three objects
+    for (unsigned i = 0; i < 35; i++) {
+        uint8_t type = circuit.allocation.gates[i * 3];
+        if (type >= RO_GATE_AND && type <= RO_GATE_NOT) {
+            unsigned body = RO_OBJ_GATE_1_BODY + i * 3;
+            Gate g = {ROGate(type), uint8_t(body), uint8_t(body + 1),
+                      uint8_t(body + 2)};
+            gates.push_back(g);
+        }
+    }
+
+    // Flip-flops only matter if something is wired to them
+    for (unsigned i = 0; i < NUM_FLIPFLOPS; i++) {
+        unsigned left = RO_OBJ_FF_1_LEFT + i * 2;
+        for (const Wire &w : wires) {
+            if (w.from == left || w.from == left + 1 || w.to == left ||
+                w.to == left + 1) {
+                flipflops.push_back(i);
+                break;
+            }
+        }
+        initial_ff[i] = circuit.ff.state[i * 2] != 0;
+    }
+}
+
+void CircuitSim::reset() {
+    memset(in, 0, sizeof in);
+    memset(out, 0, sizeof out);
+    for (unsigned i = 0; i < NUM_FLIPFLOPS; i++) {
+        ff_state[i] = initial_ff[i] ? ~Lanes(0) : 0;
+    }
+}
+
+CircuitSim::Lanes CircuitSim::step() {
+    // Returns the lanes where any watched signal changed
+    Lanes next[NUM_SIGNALS];
+    memset(next, 0, sizeof next);
+    for (const Wire &w : wires) {
+        next[w.to] |= out[w.from];
+    }
+    memcpy(in, next, sizeof in);
+
+    // Outputs start as a copy of the inputs, so anything that isn't a device
+    // passes its input along, like a node does
+    for (const Gate &g : gates) {
+        const Lanes a = in[g.in1];
+        const Lanes b = in[g.in2];
+        switch (g.type) {
+        case RO_GATE_AND:
+            next[g.out] = a & b;
+            break;
+        case RO_GATE_OR:
+            next[g.out] = a | b;
+            break;
+        case RO_GATE_XOR:
+            next[g.out] = a ^ b;
+            break;
+        case RO_GATE_NOT:
+            next[g.out] = ~a;
+            break;
+        default:
+            next[g.out] = 0;
+            break;
+        }
+    }
+
+    // Either input alone sets its own half. Both or neither hold.
+    for (unsigned i : flipflops) {
+        const unsigned left = RO_OBJ_FF_1_LEFT + i * 2;
+        const Lanes set = in[left] & ~in[left + 1];
+        const Lanes clear = in[left + 1] & ~in[left];
+        ff_state[i] = (ff_state[i] & ~clear) | set;
+        next[left] = ff_state[i];
+        next[left + 1] = ~ff_state[i];
+    }
+
+    for (unsigned i = 0; i < forced.size(); i++) {
+        next[forced[i]] = forced_lanes[i];
+    }
+
+    Lanes changed = 0;
+    for (uint16_t i : watched) {
+        changed |= next[i] ^ out[i];
+    }
+    memcpy(out, next, sizeof out);
+    return changed;
+}
+
+void CircuitSim::watchOutputs(const std::vector<unsigned> &outputs) {
+    // Everything the outputs depend on, so a clock elsewhere in the design
+    // doesn't keep a table from settling
+    bool seen[NUM_SIGNALS];
+    memset(seen, 0, sizeof seen);
+    watched.clear();
+    for (unsigned signal : outputs) {
+        if (!seen[signal]) {
+            seen[signal] = true;
+            watched.push_back(signal);
+        }
+    }
+
+    for (unsigned i = 0; i < watched.size(); i++) {
+        const unsigned signal = watched[i];
+        unsigned sources[4];
+        unsigned count = 0;
+
+        for (const Gate &g : gates) {
+            if (g.out == signal) {
+                sources[count++] = g.in1;
+                sources[count++] = g.in2;
+            }
+        }
+        for (unsigned ff : flipflops) {
+            const unsigned left = RO_OBJ_FF_1_LEFT + ff * 2;
+            if (signal == left || signal == left + 1) {
+                sources[count++] = signal ^ left ^ (left + 1);
+            }
+        }
+        for (unsigned j = 0; j < count; j++) {
+            if (!seen[sources[j]]) {
+                seen[sources[j]] = true;
+                watched.push_back(sources[j]);
+            }
+        }
+        for (const Wire &w : wires) {
+            if (w.to == signal && !seen[w.from]) {
+                seen[w.from] = true;
+                watched.push_back(w.from);
+            }
+        }
+    }
+}
+
+void CircuitSim::truthTable(const std::vector<unsigned> &inputs,
+                            const std::vector<unsigned> &outputs,
+                            unsigned max_steps, Result &result) {
+    assert(inputs.size() <= MAX_INPUTS && outputs.size() <= MAX_OUTPUTS);
+    for (unsigned signal : inputs) {
+        assert(signal < NUM_SIGNALS);
+        (void)signal;
+    }
+    for (unsigned signal : outputs) {
+        assert(signal < NUM_SIGNALS);
+        (void)signal;
+    }
+
+    const uint32_t combinations = 1u << inputs.size();
+    result.rows.assign(combinations, 0);
+    result.unstable.clear();
+    result.steps = 0;
+
+    forced = inputs;
+    forced_lanes.resize(inputs.size());
+    watchOutputs(outputs);
+
+    for (uint32_t first = 0; first < combinations; first += NUM_LANES) {
+        const unsigned count =
+            std::min<uint32_t>(NUM_LANES, combinations - first);
+        const Lanes active =
+            count == NUM_LANES ? ~Lanes(0) : (Lanes(1) << count) - 1;
+
+        for (unsigned i = 0; i < inputs.size(); i++) {
+            if (i < NUM_LANE_PATTERNS) {
+                forced_lanes[i] = lane_patterns[i];
+            } else {
+                forced_lanes[i] = (first >> i) & 1 ? ~Lanes(0) : 0;
+            }
+        }
+
+        reset();
+        Lanes changed = active;
+        unsigned steps = 0;
+        while (changed && steps < max_steps) {
+            changed = step() & active;
+            steps++;
+        }
+        result.steps += steps;
+
+        for (unsigned lane = 0; lane < count; lane++) {
+            uint32_t row = 0;
+            for (unsigned o = 0; o < outputs.size(); o++) {
+                row |= uint32_t((out[outputs[o]] >> lane) & 1) << o;
+            }
+            result.rows[first + lane] = row;
+            if ((changed >> lane) & 1) {
+                result.unstable.push_back(first + lane);
+            }
+        }
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "roData.h"
+#include <stdint.h>
+#include <vector>
+
+// A model of the player's circuit, for checking designs without running the
+// game loop. Signals are bit-sliced: each one is a 64-bit word with one input
+// vector per bit, so a single pass over the netlist evaluates 64 input
+// combinations with word-wide AND, OR, XOR and NOT.
+//
+// This isn't the game's own circuit step, and doesn't try to match its timing
+// within a frame. Every wire and device takes one step to respond, an input
+// sees the OR of every wire driving it, and designs run until they stop
+// changing. Chips are opaque; their pins can be inputs or outputs, but nothing
+// passes through them.
+class CircuitSim {
+  public:
+    typedef uint64_t Lanes;
+
+    static const unsigned NUM_LANES = 64;
+    static const unsigned MAX_INPUTS = 16;
+    static const unsigned MAX_OUTPUTS = 32;
+
+    // Signals are numbered by object ID, then 8 pins for each chip
+    static const unsigned CHIP_PIN_BASE = 0x100;
+    static const unsigned NUM_SIGNALS = CHIP_PIN_BASE + 8 * 8;
+
+    static unsigned chipPin(unsigned chip, unsigned pin) {
+        return CHIP_PIN_BASE + chip * 8 + pin;
+    }
+
+    struct Result {
+        // Output bits for each input combination. Bit N of the index is
+        // input N, bit N of the row is output N.
+        std::vector<uint32_t> rows;
+
+        // Combinations where something the outputs depend on was still
+        // changing after max_steps
+        std::vector<uint32_t> unstable;
+
+        unsigned steps; // Total, over all batches
+    };
+
+    CircuitSim();
+
+    // Build the netlist, and take flip-flop states from the circuit
+    void load(const ROCircuit &circuit);
+
+    // Try every combination of up to MAX_INPUTS inputs, 64 at a time.
+    // Each batch starts from the loaded state.
+    void truthTable(const std::vector<unsigned> &inputs,
+                    const std::vector<unsigned> &outputs, unsigned max_steps,
+                    Result &result);
+
+    unsigned getWireCount() const { return wires.size(); }
+    unsigned getGateCount() const { return gates.size(); }
+    unsigned getFlipFlopCount() const { return flipflops.size(); }
+
+  private:
+    static const unsigned NUM_FLIPFLOPS = 10;
+
+    struct Wire {
+        uint16_t from;
+        uint16_t to;
+    };
+
+    struct Gate {
+        ROGate type;
+        uint8_t out;
+        uint8_t in1;
+        uint8_t in2;
+    };
+
+    std::vector<Wire> wires;
+    std::vector<Gate> gates;
+    std::vector<uint8_t> flipflops; // Indices, of the ones wired up
+
+    // Per-flip-flop state of the left half, as loaded
+    bool initial_ff[NUM_FLIPFLOPS];
+
+    // Simulation state. Wires deliver into 'in', devices drive 'out', and
+    // outputs are read from 'out'.
+    Lanes in[NUM_SIGNALS];
+    Lanes out[NUM_SIGNALS];
+    Lanes ff_state[NUM_FLIPFLOPS];
+
+    std::vector<unsigned> forced;
+    std::vector<Lanes> forced_lanes;
+    std::vector<uint16_t> watched;
+
+    void addWire(unsigned from, unsigned to);
+    void watchOutputs(const std::vector<unsigned> &outputs);
+    void reset();
+    Lanes step();
+};
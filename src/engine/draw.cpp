@@ -2,7 +2,9 @@
 #include "roData.h"
 #include "sbt86.h"
 #include <algorithm>
+#include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 RGBDraw::RGBDraw(ColorTable &colorTable) : colorTable(colorTable) {
     // Cleared to transparent black
@@ -162,3 +164,36 @@ void RGBDraw::hline(uint8_t x1, uint8_t x2, uint8_t y, uint8_t color) {
         }
     }
 }
+
+void RGBDraw::downscale(uint32_t *dest, unsigned width, unsigned height) const {
+    // Each output pixel averages the block of pixels it covers. Channels are
+    // summed two at a time, in the 16-bit halves of a word, which holds a
+    // full 16x16 block without overflowing.
+    assert(width >= SCREEN_WIDTH / MAX_DOWNSCALE && width <= SCREEN_WIDTH);
+    assert(height >= SCREEN_HEIGHT / MAX_DOWNSCALE && height <= SCREEN_HEIGHT);
+
+    for (unsigned y = 0; y < height; y++) {
+        const unsigned y0 = y * SCREEN_HEIGHT / height;
+        const unsigned y1 = (y + 1) * SCREEN_HEIGHT / height;
+
+        for (unsigned x = 0; x < width; x++) {
+            const unsigned x0 = x * SCREEN_WIDTH / width;
+            const unsigned x1 = (x + 1) * SCREEN_WIDTH / width;
+            uint32_t even = 0, odd = 0;
+
+            for (unsigned sy = y0; sy < y1; sy++) {
+                const uint32_t *row = backbuffer + sy * SCREEN_WIDTH;
+                for (unsigned sx = x0; sx < x1; sx++) {
+                    even += row[sx] & 0x00FF00FF;
+                    odd += (row[sx] >> 8) & 0x00FF00FF;
+                }
+            }
+
+            const unsigned area = (x1 - x0) * (y1 - y0);
+            *(dest++) = ((even & 0xFFFF) / area) |
+                        (((odd & 0xFFFF) / area) << 8) |
+                        (((even >> 16) / area) << 16) |
+                        (((odd >> 16) / area) << 24);
+        }
+    }
+}
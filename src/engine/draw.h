@@ -41,4 +41,9 @@ class RGBDraw {
                        unsigned anchor_y);
     void pixel_320x192(unsigned x, unsigned y, uint8_t color, unsigned anchor_x,
                        unsigned anchor_y);
+
+    // Box-filtered copy of the backbuffer, for thumbnails. Each side can
+    // shrink by up to MAX_DOWNSCALE.
+    static const unsigned MAX_DOWNSCALE = 16;
+    void downscale(uint32_t *dest, unsigned width, unsigned height) const;
 };
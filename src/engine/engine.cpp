@@ -1,4 +1,14 @@
+#include "batchHost.h"
+#include "circuitSim.h"
 #include "hardware.h"
+#include "inputMovie.h"
+#include "puzzleSearch.h"
+#include "replayVerify.h"
+#include "rewind.h"
+#include "snapshot.h"
+#include "stateHash.h"
+#include "soundTrace.h"
+#include "thumbnailCache.h"
 #include "tinySave.h"
 #include <algorithm>
 #include <circular_buffer.hpp>
@@ -6,14 +16,21 @@
 #include <emscripten.h>
 #include <emscripten/bind.h>
 #include <emscripten/html5.h>
+#include <memory>
 #include <stdint.h>
+#include <stdio.h>
 #include <vector>
 
 using namespace emscripten;
 
 static bool has_frame_callback = false;
 static double engine_speed = 1.0;
-static TinySave tinySave;
+static SoundTrace soundTrace;
+static HardwareSnapshot quickSnapshot;
+static RewindBuffer rewindBuffer;
+static MovieRecorder movieRecorder;
+static StateHasher stateHasher;
+static bool state_trace_enabled = false;
 
 #define TIMESTAMP_FILTER_MAX_SAMPLES 16
 #define TIMESTAMP_FILTER_MIN_SAMPLES 3
@@ -27,24 +44,78 @@ SBT_DECL_PROCESS(LabEXE);
 SBT_DECL_PROCESS(GameEXE);
 SBT_DECL_PROCESS(TutorialEXE);
 
-// Main hardware instance, for running the game
+// Filled in from Javascript, shared by every instance
 static ColorTable colorTable;
-static OutputQueue outputQueue(colorTable);
-static Hardware hw(outputQueue);
-SBT_STATIC_PROCESS(hw, ShowEXE);
-SBT_STATIC_PROCESS(hw, Show2EXE);
-SBT_STATIC_PROCESS(hw, LabEXE);
-SBT_STATIC_PROCESS(hw, GameEXE);
-SBT_STATIC_PROCESS(hw, TutorialEXE);
+
+// Everything larger is built on first use rather than by static
+// constructors, and the time each one took is kept for getStartupTimes().
+struct StartupTime {
+    const char *name;
+    double msec;
+};
+static std::vector<StartupTime> startup_times;
+
+template <typename T> static T *createTimed(const char *name) {
+    double start = emscripten_get_now();
+    T *object = new T();
+    StartupTime t = {name, emscripten_get_now() - start};
+    startup_times.push_back(t);
+    return object;
+}
+
+// Main hardware instance, for running the game
+struct MainInstance {
+    OutputQueue output;
+    Hardware hw;
+    ShowEXE show;
+    Show2EXE show2;
+    LabEXE lab;
+    GameEXE game;
+    TutorialEXE tutorial;
+
+    MainInstance()
+        : output(colorTable), hw(output), show(&hw), show2(&hw), lab(&hw),
+          game(&hw), tutorial(&hw) {}
+};
 
 // Auxiliary hardware instance, for screenshots. Shares main color table.
-static OutputInterface outputAux(colorTable);
-static Hardware hwAux(outputAux);
-SBT_STATIC_PROCESS(hwAux, LabEXE);
-SBT_STATIC_PROCESS(hwAux, GameEXE);
+struct AuxInstance {
+    OutputInterface output;
+    Hardware hw;
+    LabEXE lab;
+    GameEXE game;
+
+    AuxInstance() : output(colorTable), hw(output), lab(&hw), game(&hw) {}
+};
+
+static MainInstance &getMain() {
+    static MainInstance *instance = createTimed<MainInstance>("main");
+    return *instance;
+}
+
+static AuxInstance &getAux() {
+    static AuxInstance *instance = createTimed<AuxInstance>("aux");
+    return *instance;
+}
+
+static OutputQueue &getReplayQueue() {
+    // Sound trace replays all share one queue. It's over 2 MB, and the heap
+    // doesn't grow.
+    static OutputQueue *queue = new OutputQueue(colorTable);
+    return *queue;
+}
+
+static TinySave &getTinySave() {
+    // Builds its dictionary and compression contexts
+    static TinySave *instance = createTimed<TinySave>("tinySave");
+    return *instance;
+}
 
 static int frameCallback(double loop_timestamp, void *) {
     // Check the speed control, pause callbacks if the engine is paused
+    Hardware &hw = getMain().hw;
+    OutputQueue &outputQueue = getMain().output;
+
     const double speed = engine_speed;
     if (!(speed > 0.0)) {
         has_frame_callback = false;
@@ -96,6 +167,7 @@ static int frameCallback(double loop_timestamp, void *) {
             if (queue_delay == 0) {
                 if (hw.process) {
                     hw.process->run();
+                    movieRecorder.countStep();
                     continue;
                 } else {
                     has_frame_callback = false;
@@ -106,6 +178,12 @@ static int frameCallback(double loop_timestamp, void *) {
             break;
         }
         if (saved_frame_count != outputQueue.getFrameCount()) {
+            // Every presented frame is a rewind point
+            rewindBuffer.push(hw);
+            if (state_trace_enabled) {
+                stateHasher.push(hw);
+            }
+
             // Don't call onRenderFrame() more than once per
             // requestAnimationFrame, add an extra delay if we are running fast.
             if (delay_accumulator >= 0.) {
@@ -135,14 +213,33 @@ int main() {
     return 0;
 }
 
+static val copyBytes(const std::vector<uint8_t> &bytes) {
+    val view = val(typed_memory_view(bytes.size(), bytes.data()));
+    return view.call<val>("slice");
+}
+
+static void copyBytesFrom(val array, std::vector<uint8_t> &bytes) {
+    bytes.resize(array["length"].as<uint32_t>());
+    val dest_view = val(typed_memory_view(bytes.size(), bytes.data()));
+    dest_view.call<void>("set", array);
+}
+
+static bool applyInput(const InputEvent &event) {
+    // All input to the main instance comes through here, for recording
+    Hardware &hw = getMain().hw;
+
+    return movieRecorder.apply(hw, event);
+}
+
 static void exec(const std::string &process, const std::string &arg) {
-    outputQueue.clear();
-    hw.exec(process.c_str(), arg.c_str());
+    applyInput(InputEvent::exec(process.c_str(), arg.c_str()));
     resumeFrameCallbacks();
 }
 
 static void setSpeed(double speed) {
     // Stored speed for delay calculations, used on each main loop iter
+    OutputQueue &outputQueue = getMain().output;
+
     engine_speed = speed;
 
     // Update frameskip so we can fast-forward without being limited by draw
@@ -155,31 +252,530 @@ static void setSpeed(double speed) {
     }
 }
 
+static void setSpeakerSynthesis(SpeakerSynthesis synthesis) {
+    OutputQueue &outputQueue = getMain().output;
+
+    outputQueue.setSpeakerSynthesis(synthesis);
+}
+
+static void benchmarkSound() {
+    // Compare sound synthesis types, results are logged to the console. Just
+    // for development; this takes a few seconds.
+    OutputQueue &outputQueue = getMain().output;
+
+    SpeakerRenderer::benchmark(outputQueue.getAudioRate());
+}
+
+static uint32_t setAudioRate(uint32_t hz) {
+    OutputQueue &outputQueue = getMain().output;
+
+    return outputQueue.setAudioRate(hz);
+}
+
+static void startSoundTrace() {
+    // Record the main game's speaker activity, for replay with the functions
+    // below. Just for development; capture a cutscene or some gameplay, then
+    // save the stopSoundTrace() result along with renderSoundTrace() output
+    // as golden PCM in test/sound, for "make sound-check".
+    OutputQueue &outputQueue = getMain().output;
+
+    soundTrace.clear();
+    outputQueue.setSoundTrace(&soundTrace);
+}
+
+static val stopSoundTrace() {
+    OutputQueue &outputQueue = getMain().output;
+
+    outputQueue.setSoundTrace(nullptr);
+    val view = val(
+        typed_memory_view(soundTrace.words.size(), soundTrace.words.data()));
+    return view.call<val>("slice");
+}
+
+static void setSoundTrace(val trace) {
+    OutputQueue &outputQueue = getMain().output;
+
+    outputQueue.setSoundTrace(nullptr);
+    uint32_t size = trace["length"].as<uint32_t>();
+    soundTrace.words.resize(std::min<size_t>(size, SoundTrace::MAX_WORDS));
+    val dest_view = val(
+        typed_memory_view(soundTrace.words.size(), soundTrace.words.data()));
+    dest_view.call<void>("set", trace.call<val>("subarray", 0, size));
+}
+
+static val renderSoundTrace(val trace, SpeakerSynthesis synthesis,
+                            uint32_t rate) {
+    // Replay a trace headlessly, returning all effects as one Float32Array
+
+    struct ChunkSink : public SoundSink {
+        val chunks = val::array();
+        virtual void renderSound(const float *pcm, uint32_t count, uint32_t) {
+            chunks.call<void>("push",
+                              val(typed_memory_view(count, pcm)).call<val>(
+                                  "slice"));
+        }
+    } sink;
+
+    setSoundTrace(trace);
+    uint32_t samples = soundTrace.replay(sink, getReplayQueue(), synthesis,
+                                         rate);
+
+    val result = val::global("Float32Array").new_(samples);
+    uint32_t offset = 0;
+    uint32_t num_chunks = sink.chunks["length"].as<uint32_t>();
+    for (uint32_t i = 0; i < num_chunks; i++) {
+        val chunk = sink.chunks[i];
+        result.call<void>("set", chunk, offset);
+        offset += chunk["length"].as<uint32_t>();
+    }
+    return result;
+}
+
+static val checkSoundTrace(val trace, val golden, SpeakerSynthesis synthesis,
+                           uint32_t rate, double min_snr_db) {
+    // Replay a trace headlessly, comparing it to golden PCM from an earlier
+    // renderSoundTrace(). Golden samples are copied in one effect at a time.
+
+    struct CompareSink : public SoundSink {
+        val golden;
+        uint32_t golden_count;
+        uint32_t position;
+        std::vector<float> scratch;
+        SoundCompare compare;
+
+        CompareSink(val golden)
+            : golden(golden), golden_count(golden["length"].as<uint32_t>()),
+              position(0) {}
+
+        virtual void renderSound(const float *pcm, uint32_t count, uint32_t) {
+            count = std::min(count, golden_count - position);
+            scratch.resize(count);
+            val dest_view = val(typed_memory_view(count, scratch.data()));
+            dest_view.call<void>("set", golden.call<val>("subarray", position,
+                                                         position + count));
+            compare.compare(pcm, scratch.data(), count);
+            position += count;
+        }
+    } sink(golden);
+
+    setSoundTrace(trace);
+    uint32_t samples = soundTrace.replay(sink, getReplayQueue(), synthesis,
+                                         rate);
+    double snr = sink.compare.snr();
+
+    val r = val::object();
+    r.set("samples", samples);
+    r.set("goldenSamples", sink.golden_count);
+    r.set("snr", snr);
+    r.set("pass", samples == sink.golden_count && snr >= min_snr_db);
+    return r;
+}
+
+static void benchmarkSoundTrace(val trace) {
+    // Replay a trace with each synthesis type, logging samples per second
+    // to the console.
+    OutputQueue &outputQueue = getMain().output;
+
+    setSoundTrace(trace);
+    soundTrace.benchmark(getReplayQueue(), outputQueue.getAudioRate());
+}
+
+static void benchmarkBatch(unsigned instances, unsigned frames) {
+    // Run independent copies of the game side by side, logging aggregate
+    // frames per second. Just for development; each instance needs over a
+    // megabyte, so keep the count small in the browser.
+    BatchHost::benchmark(colorTable, instances, frames);
+}
+
 static void pressKey(uint8_t ascii, uint8_t scancode) {
-    hw.input.pressKey(ascii, scancode);
+    applyInput(InputEvent(InputEvent::KEY, ascii, scancode));
 }
 
 static void setJoystickAxes(float x, float y) {
-    hw.input.setJoystickAxes(x, y);
+    applyInput(InputEvent::joystickAxes(x, y));
 }
 
 static void setJoystickButton(bool button) {
-    hw.input.setJoystickButton(button);
+    applyInput(InputEvent(InputEvent::JOYSTICK_BUTTON, button));
+}
+
+static void setMouseTracking(int x, int y) {
+    applyInput(InputEvent(InputEvent::MOUSE_TRACKING, x, y));
+}
+
+static void setMouseButton(bool button) {
+    applyInput(InputEvent(InputEvent::MOUSE_BUTTON, button));
+}
+
+static void endMouseTracking() {
+    applyInput(InputEvent(InputEvent::END_MOUSE_TRACKING));
+}
+
+static SaveStatus saveGameToSlot(DOSFilesystem::SaveSlot slot) {
+    // The save function runs game code, which changes the game's state, so
+    // it goes through applyInput() like any other input to be recorded.
+    // Saves that can't start are left out.
+    SaveStatus status = getMain().hw.canSaveGame();
+    if (status != SaveStatus::OK) {
+        return status;
+    }
+    return applyInput(InputEvent(InputEvent::SAVE_GAME, slot))
+               ? SaveStatus::OK
+               : SaveStatus::NOT_SUPPORTED;
+}
+
+static SaveStatus saveGame() {
+    return saveGameToSlot(DOSFilesystem::USER_SLOT);
+}
+
+static bool loadChip(uint8_t id) {
+    return applyInput(InputEvent(InputEvent::LOAD_CHIP, id));
+}
+
+static void startMovieRecording() {
+    // Record input into a movie, starting at the next exec() or loadGame().
+    // Save-states and rewinding end the recording.
+    movieRecorder.start();
+}
+
+static val stopMovieRecording() {
+    Hardware &hw = getMain().hw;
+
+    movieRecorder.stop(hw);
+    return copyBytes(movieRecorder.getBytes());
+}
+
+static val verifyMovie(val movie, unsigned interval_frames) {
+    // Check that a movie replays the same way when split into segments and
+    // replayed from keyframes in parallel. Just for development; keyframes
+    // take over a megabyte each, so use long intervals in the browser.
+    std::vector<uint8_t> bytes;
+    copyBytesFrom(movie, bytes);
+
+    SegmentedReplay replay(colorTable);
+    if (!replay.load(bytes.data(), bytes.size())) {
+        return val::null();
+    }
+
+    double start = emscripten_get_now();
+    unsigned keyframes = replay.record(std::max(1u, interval_frames));
+    double reference_msec = emscripten_get_now() - start;
+
+    start = emscripten_get_now();
+    SegmentedReplay::Result result =
+        replay.verify(BatchHost::getMaxThreads());
+    double verify_msec = emscripten_get_now() - start;
+
+    val r = val::object();
+    r.set("keyframes", keyframes);
+    r.set("segments", result.segments);
+    r.set("threads", BatchHost::getMaxThreads());
+    r.set("referenceMsec", reference_msec);
+    r.set("verifyMsec", verify_msec);
+    r.set("failedSegment", result.first_failed);
+    r.set("failedFrame", result.first_failed_frame);
+    r.set("pass", result.first_failed < 0);
+    return r;
+}
+
+static double searchOption(val options, const char *name, double fallback) {
+    val v = options[name];
+    return v.isUndefined() ? fallback : v.as<double>();
+}
+
+static val searchPuzzle(val options) {
+    // Brute-force search from the current state for a way to walk the
+    // player to options.room near (options.x, options.y). Path entries are
+    // action indices: 0-7 are joystick directions clockwise from up, 8 is
+    // the button. Just for development; every open node holds a snapshot.
+    Hardware &hw = getMain().hw;
+
+    static const int8_t directions[8][2] = {
+        {0, -1}, {1, -1}, {1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-1, -1},
+    };
+    PuzzleSearch search(colorTable);
+    for (unsigned i = 0; i < 8; i++) {
+        std::vector<InputEvent> action;
+        action.push_back(
+            InputEvent::joystickAxes(directions[i][0], directions[i][1]));
+        action.push_back(InputEvent(InputEvent::JOYSTICK_BUTTON, false));
+        search.addAction(action);
+    }
+    std::vector<InputEvent> button;
+    button.push_back(InputEvent::joystickAxes(0, 0));
+    button.push_back(InputEvent(InputEvent::JOYSTICK_BUTTON, true));
+    search.addAction(button);
+    search.setFramesPerAction(searchOption(options, "frames", 4));
+
+    PuzzleSearch::ReachPosition objective(
+        RORoomId(searchOption(options, "room", 0)),
+        searchOption(options, "x", 0), searchOption(options, "y", 0),
+        searchOption(options, "tolerance", 4));
+    PuzzleSearch::Strategy strategy = searchOption(options, "bestFirst", 1)
+                                          ? PuzzleSearch::BEST_FIRST
+                                          : PuzzleSearch::BREADTH_FIRST;
+
+    double start = emscripten_get_now();
+    PuzzleSearch::Result result = search.search(
+        hw, objective, strategy, searchOption(options, "maxNodes", 2000),
+        searchOption(options, "maxDepth", 32), BatchHost::getMaxThreads());
+    double msec = emscripten_get_now() - start;
+
+    val path = val::array();
+    for (unsigned i = 0; i < result.path.size(); i++) {
+        path.set(i, result.path[i]);
+    }
+    val r = val::object();
+    r.set("found", result.found);
+    r.set("path", path);
+    r.set("bestScore", result.best_score);
+    r.set("expanded", result.expanded);
+    r.set("uniqueStates", result.unique_states);
+    r.set("msec", msec);
+    return r;
+}
+
+static bool signalList(val list, unsigned max_size,
+                       std::vector<unsigned> &signals) {
+    const unsigned size = list["length"].as<unsigned>();
+    if (size > max_size) {
+        return false;
+    }
+    signals.clear();
+    for (unsigned i = 0; i < size; i++) {
+        unsigned signal = list[i].as<unsigned>();
+        if (signal >= CircuitSim::NUM_SIGNALS) {
+            return false;
+        }
+        signals.push_back(signal);
+    }
+    return true;
+}
+
+static val circuitTruthTable(val inputs, val outputs, unsigned max_steps) {
+    // Try every combination of inputs on the main instance's circuit.
+    // Signals are object IDs, or 0x100 + chip * 8 + pin. Row N of the
+    // result has bit M set if output M was on with inputs matching the bits
+    // of N. Just for development; CircuitSim describes how it differs from
+    // the game's own timing. Returns null if there's no circuit, or too many
+    // signals.
+    Hardware &hw = getMain().hw;
+
+    ROData data;
+    std::vector<unsigned> in, out;
+    if (!hw.process || !data.fromProcess(hw.process) ||
+        !signalList(inputs, CircuitSim::MAX_INPUTS, in) ||
+        !signalList(outputs, CircuitSim::MAX_OUTPUTS, out)) {
+        return val::null();
+    }
+
+    double start = emscripten_get_now();
+    CircuitSim sim;
+    CircuitSim::Result result;
+    sim.load(*data.circuit);
+    sim.truthTable(in, out, max_steps, result);
+    double msec = emscripten_get_now() - start;
+
+    val r = val::object();
+    r.set("rows", val::global("Uint32Array")
+                      .new_(typed_memory_view(result.rows.size(),
+                                              result.rows.data())));
+    r.set("unstable", val::global("Uint32Array")
+                          .new_(typed_memory_view(result.unstable.size(),
+                                                  result.unstable.data())));
+    r.set("steps", result.steps);
+    r.set("wires", sim.getWireCount());
+    r.set("gates", sim.getGateCount());
+    r.set("flipFlops", sim.getFlipFlopCount());
+    r.set("msec", msec);
+    return r;
+}
+
+static void startStateTrace() {
+    // Hash the main instance's state on every presented frame. Just for
+    // development; traces from two builds can be compared to find where
+    // they diverge.
+    stateHasher.clear();
+    state_trace_enabled = true;
 }
 
-static void setMouseTracking(int x, int y) { hw.input.setMouseTracking(x, y); }
+static val stopStateTrace() {
+    state_trace_enabled = false;
+    val trace = copyBytes(stateHasher.getTrace());
+    stateHasher.clear();
+    return trace;
+}
+
+static val compareStateTraces(val a, val b) {
+    // Returns null if the traces match, otherwise the first frame that
+    // differs, which part of the state differs, and the memory page if any.
+    static const char *parts[] = {"none",   "mem",    "regs",
+                                  "output", "length", "malformed"};
+    std::vector<uint8_t> a_bytes, b_bytes;
+    copyBytesFrom(a, a_bytes);
+    copyBytesFrom(b, b_bytes);
+
+    StateHasher::Divergence d = StateHasher::compare(
+        a_bytes.data(), a_bytes.size(), b_bytes.data(), b_bytes.size());
+    if (d.part == StateHasher::Divergence::NONE) {
+        return val::null();
+    }
+    val r = val::object();
+    r.set("frame", d.frame);
+    r.set("part", std::string(parts[d.part]));
+    r.set("page", d.page);
+    r.set("address", d.page < 0 ? -1 : d.page * int(StateHasher::PAGE_SIZE));
+    return r;
+}
+
+static val replayMovie(val movie, bool with_state_trace) {
+    // Replay a movie headlessly on a private instance, as fast as possible.
+    // Has no effect on the main game instance. Returns null if the movie
+    // can't be parsed. Optionally includes a state trace of every frame, to
+    // compare against other builds with compareStateTraces().
 
-static void setMouseButton(bool button) { hw.input.setMouseButton(button); }
+    std::vector<uint8_t> bytes;
+    copyBytesFrom(movie, bytes);
 
-static void endMouseTracking() { hw.input.endMouseTracking(); }
+    MoviePlayer player;
+    if (!player.load(bytes.data(), bytes.size())) {
+        return val::null();
+    }
+    bytes.clear();
+    bytes.shrink_to_fit();
 
-static SaveStatus saveGame() { return hw.saveGame(); }
+    BatchHost host(colorTable);
+    host.addInstance("");
+    host.setMovie(0, &player);
+    std::unique_ptr<StateHasher> hasher;
+    if (with_state_trace) {
+        hasher.reset(new StateHasher);
+        host.setStateHasher(0, hasher.get());
+    }
+    double start = emscripten_get_now();
+    host.run(UINT32_MAX, 1);
+    double msec = emscripten_get_now() - start;
 
-static bool loadChip(uint8_t id) { return hw.loadChip(id); }
+    val r = val::object();
+    r.set("events", player.getEventCount());
+    r.set("steps", player.getStepCount());
+    r.set("frames", double(host.getTotalFrames()));
+    r.set("msec", msec);
+    r.set("finished", player.isFinished());
+    r.set("desyncEvent", player.getDesyncEvent());
+    r.set("pass", player.isFinished() && player.getDesyncEvent() < 0);
+    if (hasher) {
+        r.set("stateTrace", copyBytes(hasher->getTrace()));
+    }
+    return r;
+}
+
+static val chipSimStats(const ChipSim::Stats &stats) {
+    val r = val::object();
+    r.set("passes", stats.passes);
+    r.set("decodes", stats.decodes);
+    r.set("fallbacks", stats.fallbacks);
+    r.set("mismatches", stats.mismatches);
+    r.set("firstChip", stats.first_chip);
+    r.set("firstByte", stats.first_byte);
+    return r;
+}
+
+static void setChipSimMode(ChipSimMode mode) {
+    // Choose how the main instance simulates chips. NATIVE is only for
+    // sessions where checkChipSim() has passed; CHECK runs both simulators
+    // and keeps the results from the translated one.
+    getMain().hw.chips.setMode(mode);
+}
+
+static val getChipSimStats() {
+    return chipSimStats(getMain().hw.chips.getStats());
+}
+
+static val checkChipSim(val movie) {
+    // Replay a movie headlessly with both chip simulators, comparing every
+    // chip after every pass. Just for development. Returns null if the
+    // movie can't be parsed.
+    std::vector<uint8_t> bytes;
+    copyBytesFrom(movie, bytes);
+
+    MoviePlayer player;
+    if (!player.load(bytes.data(), bytes.size())) {
+        return val::null();
+    }
+    bytes.clear();
+    bytes.shrink_to_fit();
+
+    BatchHost host(colorTable);
+    host.addInstance("");
+    host.getInstance(0).chips.setMode(CHIP_SIM_CHECK);
+    host.setMovie(0, &player);
+    double start = emscripten_get_now();
+    host.run(UINT32_MAX, 1);
+    double msec = emscripten_get_now() - start;
+
+    const ChipSim::Stats &stats = host.getInstance(0).chips.getStats();
+    val r = chipSimStats(stats);
+    r.set("frames", double(host.getTotalFrames()));
+    r.set("msec", msec);
+    r.set("finished", player.isFinished());
+    r.set("desyncEvent", player.getDesyncEvent());
+    r.set("pass", player.isFinished() && player.getDesyncEvent() < 0 &&
+                      stats.mismatches == 0);
+    return r;
+}
+
+static unsigned saveSnapshot() {
+    // Quick-save the entire machine, including menus and the tutorial where
+    // saveGame() isn't supported. Returns the number of 4 KB pages that
+    // changed since the last quick-save.
+    Hardware &hw = getMain().hw;
+
+    HardwareSnapshot snapshot;
+    hw.saveSnapshot(snapshot, &quickSnapshot);
+    quickSnapshot = snapshot;
+    return snapshot.new_pages;
+}
+
+static void setRewindBudget(double bytes) {
+    // Rewind history is off by default. The newest state also needs about
+    // 1.3 MB beyond this budget, and there's no memory growth.
+    rewindBuffer.setBudget(size_t(std::max(0.0, bytes)));
+}
+
+static unsigned rewindFrames(unsigned frames) {
+    // Step back through presented frames. Returns the number of frames
+    // actually rewound; the history ends at the oldest frame kept.
+    Hardware &hw = getMain().hw;
+
+    movieRecorder.stop(hw);
+    unsigned result = rewindBuffer.stepBack(hw, frames);
+    resumeFrameCallbacks();
+    return result;
+}
+
+static val getRewindInfo() {
+    val r = val::object();
+    r.set("frames", rewindBuffer.getFrameCount());
+    r.set("bytes", double(rewindBuffer.getMemoryUsage()));
+    r.set("budget", double(rewindBuffer.getBudget()));
+    return r;
+}
+
+static bool loadSnapshot() {
+    Hardware &hw = getMain().hw;
+
+    if (quickSnapshot.mem.getPageCount() == 0) {
+        return false;
+    }
+    movieRecorder.stop(hw);
+    hw.loadSnapshot(quickSnapshot);
+    resumeFrameCallbacks();
+    return true;
+}
 
 static bool loadGame() {
-    if (hw.loadGame()) {
-        outputQueue.clear();
+    if (applyInput(InputEvent(InputEvent::LOAD_GAME))) {
         resumeFrameCallbacks();
         return true;
     }
@@ -190,35 +786,96 @@ static val getFile(const FileInfo &file) {
     return val(typed_memory_view(file.size, file.data));
 }
 
-static val getStaticFiles() {
-    val files = val::object();
+static val getStaticFileNames() {
+    // Names only, so listing files doesn't unpack them all
+    val names = val::array();
+    for (unsigned i = 0; i < CompressedFileInfo::getCount(); i++) {
+        names.set(i, CompressedFileInfo::getName(i));
+    }
+    return names;
+}
+
+static val getStaticFile(const std::string &name) {
+    const FileInfo *info = FileInfo::lookup(name.c_str());
+    return info ? getFile(*info) : val::null();
+}
 
-    for (const FileInfo *info = FileInfo::getAllFiles(); info->name; info++) {
-        files.set(info->name, getFile(*info));
+static val getStartupTimes() {
+    // Milliseconds spent building each lazily created component so far
+    val times = val::object();
+    for (const StartupTime &t : startup_times) {
+        times.set(t.name, t.msec);
     }
+    return times;
+}
 
-    return files;
+static val getFileLoads() {
+    // Recently closed files, oldest first, then forget them. Call this
+    // before and after a level transition to see what it loaded.
+    DOSFilesystem &fs = getMain().hw.fs;
+    val loads = val::array();
+    for (unsigned i = 0; i < fs.getLoadCount(); i++) {
+        const DOSFilesystem::LoadRecord &load = fs.getLoad(i);
+        val r = val::object();
+        r.set("name", std::string(load.name));
+        r.set("calls", load.calls);
+        r.set("bytes", load.bytes);
+        r.set("whole", load.whole);
+        r.set("lookupMsec", load.lookup_msec);
+        r.set("openMsec", load.open_msec);
+        loads.set(i, r);
+    }
+    fs.clearLoads();
+    return loads;
 }
 
 static val getMemory() {
+    Hardware &hw = getMain().hw;
+
     return val(typed_memory_view(Hardware::MEM_SIZE, hw.mem));
 }
 
+static val getDirtyPages() {
+    // One byte per 256-byte page of getMemory(), nonzero if written since
+    // the last clearDirtyPages(). Scripts have their own bit in the map, so
+    // clearing it here doesn't hide anything from snapshots or hashing.
+    static uint8_t flags[Hardware::NUM_DIRTY_PAGES];
+    Hardware &hw = getMain().hw;
+
+    hw.getDirtyPages(Hardware::DIRTY_SCRIPT, 1 << Hardware::DIRTY_PAGE_SHIFT,
+                     flags);
+    return val(typed_memory_view(sizeof flags, flags));
+}
+
+static void clearDirtyPages() {
+    getMain().hw.clearDirtyPages(Hardware::DIRTY_SCRIPT);
+}
+
 static val getCompressionDictionary() {
+    TinySave &tinySave = getTinySave();
+
     const std::vector<uint8_t> &dict = tinySave.getCompressionDictionary();
     return val(typed_memory_view(dict.size(), &dict[0]));
 }
 
-static val getJoyFile() { return getFile(hw.fs.config.file); }
+static val getJoyFile() { return getFile(getMain().hw.fs.config.file); }
 
-static val getSaveFile() { return getFile(hw.fs.save.file); }
+static val getSaveFile() { return getFile(getMain().hw.fs.save.file); }
+
+static val getSaveSlot(DOSFilesystem::SaveSlot slot) {
+    return getFile(getMain().hw.fs.getSaveSlot(slot).file);
+}
+
+static bool copySaveFile(val buffer, bool compressed, FileInfo &file,
+                         uint8_t *file_buffer) {
+    // Copy a raw or packed save from Javascript into file, whose data points
+    // at a buffer of DOSFilesystem::MAX_FILESIZE bytes
+    TinySave &tinySave = getTinySave();
 
-static bool setSaveFileWithInstance(val buffer, Hardware &inst,
-                                    bool compressed) {
     uint32_t size = buffer["length"].as<uint32_t>();
     uint32_t max_size =
-        compressed ? sizeof tinySave.buffer : sizeof inst.fs.save.buffer;
-    uint8_t *dest_addr = compressed ? tinySave.buffer : inst.fs.save.buffer;
+        compressed ? sizeof tinySave.buffer : DOSFilesystem::MAX_FILESIZE;
+    uint8_t *dest_addr = compressed ? tinySave.buffer : file_buffer;
 
     if (size > max_size) {
         return false;
@@ -232,21 +889,86 @@ static bool setSaveFileWithInstance(val buffer, Hardware &inst,
 
     if (compressed) {
         tinySave.size = size;
-        return tinySave.decompress(inst.fs.save.file);
+        return tinySave.decompress(file);
     } else {
-        inst.fs.save.file.size = size;
+        file.size = size;
         return true;
     }
 }
 
+static bool setSaveFileWithInstance(val buffer, Hardware &inst,
+                                    bool compressed) {
+    return copySaveFile(buffer, compressed, inst.fs.save.file,
+                        inst.fs.save.buffer);
+}
+
+static val saveInfoValue(const ROSaveInfo &info) {
+    val robots = val::array();
+    for (unsigned i = 0; i < info.robotCount; i++) {
+        val bot = val::object();
+        bot.set("id", int(info.robots[i].id));
+        bot.set("room", int(info.robots[i].room));
+        bot.set("x", info.robots[i].x);
+        bot.set("y", info.robots[i].y);
+        robots.set(i, bot);
+    }
+
+    val r = val::object();
+    r.set("worldId", info.worldId);
+    r.set("worldName", std::string(info.worldName));
+    r.set("room", int(info.playerRoom));
+    r.set("x", info.playerX);
+    r.set("y", info.playerY);
+    r.set("robots", robots);
+    return r;
+}
+
+static val getSaveInfo(val buffer, bool compressed) {
+    // Summarize a raw or packed saved game without running it, or touching
+    // any Hardware instance. Returns null if it isn't a game file.
+    static uint8_t data[DOSFilesystem::MAX_FILESIZE];
+    FileInfo file = {nullptr, data, 0};
+    if (!copySaveFile(buffer, compressed, file, data) ||
+        file.size != sizeof(ROSavedGame)) {
+        return val::null();
+    }
+
+    ROSaveInfo info;
+    reinterpret_cast<ROSavedGame *>(data)->getInfo(info);
+    return saveInfoValue(info);
+}
+
 static bool setSaveFile(val buffer, bool compressed) {
-    return setSaveFileWithInstance(buffer, hw, compressed);
+    Hardware &hw = getMain().hw;
+
+    if (!setSaveFileWithInstance(buffer, hw, compressed)) {
+        return false;
+    }
+    if (movieRecorder.isRecording()) {
+        applyInput(InputEvent::saveFile(hw.fs.save.file));
+    }
+    return true;
+}
+
+static val imageData(const uint32_t *pixels, unsigned width,
+                     unsigned height) {
+    // Copy pixels out as an ImageData, which needs a Uint8ClampedArray
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(pixels);
+    val view = val(typed_memory_view(width * height * sizeof pixels[0], bytes));
+    size_t view_offset = view["byteOffset"].as<size_t>();
+    size_t view_size = view["byteLength"].as<size_t>();
+    val clamped_buffer = val::global("Uint8ClampedArray").new_(view["buffer"]);
+    val clamped_slice =
+        clamped_buffer.call<val>("slice", view_offset, view_offset + view_size);
+    return val::global("ImageData").new_(clamped_slice, width, height);
 }
 
 static val screenshotSaveFile(val buffer, bool compressed) {
     // Load the save file within our auxiliary hardware instance, and run until
     // the first frame. Has no effect on the main game instance. Returns null if
     // the save file can't be loaded.
+    Hardware &hwAux = getAux().hw;
+    OutputInterface &outputAux = getAux().output;
 
     if (!setSaveFileWithInstance(buffer, hwAux, compressed)) {
         return val::null();
@@ -263,40 +985,223 @@ static val screenshotSaveFile(val buffer, bool compressed) {
         hwAux.process->run();
     } while (outputAux.getFrameCount() == 0);
 
-    uint8_t *image_bytes =
-        reinterpret_cast<uint8_t *>(outputAux.draw.backbuffer);
-    size_t image_byte_count = sizeof outputAux.draw.backbuffer;
-    unsigned width = RGBDraw::SCREEN_WIDTH;
-    unsigned height = RGBDraw::SCREEN_HEIGHT;
-    val view = val(typed_memory_view(image_byte_count, image_bytes));
+    return imageData(outputAux.draw.backbuffer, RGBDraw::SCREEN_WIDTH,
+                     RGBDraw::SCREEN_HEIGHT);
+}
 
-    // The buffer view must be re-wrapped as Uint8ClampedArray for ImageData
-    size_t view_offset = view["byteOffset"].as<size_t>();
-    size_t view_size = view["byteLength"].as<size_t>();
-    val clamped_buffer = val::global("Uint8ClampedArray").new_(view["buffer"]);
-    val clamped_slice =
-        clamped_buffer.call<val>("slice", view_offset, view_offset + view_size);
-    val image = val::global("ImageData").new_(clamped_slice, width, height);
-    return image;
+class JSThumbnailStore : public ThumbnailCache::Store {
+    // Persists cache entries through Module.thumbnailStore, if the page
+    // provides one: {load(key) -> Uint8Array or null, save(key, bytes)}.
+    // Keys are hex strings. Both are synchronous; a page backed by
+    // IndexedDB can preload its entries and write back lazily.
+  public:
+    virtual bool load(uint64_t key, std::vector<uint8_t> &blob) {
+        val store = val::module_property("thumbnailStore");
+        if (store.isUndefined() || store.isNull()) {
+            return false;
+        }
+        val bytes = store.call<val>("load", keyString(key));
+        if (bytes.isUndefined() || bytes.isNull()) {
+            return false;
+        }
+        blob.resize(bytes["length"].as<size_t>());
+        val view = val(typed_memory_view(blob.size(), blob.data()));
+        view.call<void>("set", bytes);
+        return true;
+    }
+
+    virtual void save(uint64_t key, const std::vector<uint8_t> &blob) {
+        val store = val::module_property("thumbnailStore");
+        if (store.isUndefined() || store.isNull()) {
+            return;
+        }
+        val view = val(typed_memory_view(blob.size(), blob.data()));
+        store.call<void>("save", keyString(key),
+                         val::global("Uint8Array").new_(view));
+    }
+
+  private:
+    static std::string keyString(uint64_t key) {
+        char str[17];
+        snprintf(str, sizeof str, "%08x%08x", uint32_t(key >> 32),
+                 uint32_t(key));
+        return str;
+    }
+};
+
+static ThumbnailCache &getThumbnailCache() {
+    static JSThumbnailStore store;
+    static ThumbnailCache *cache = nullptr;
+    if (!cache) {
+        // Room for a few dozen half-size thumbnails
+        cache = new ThumbnailCache(4 * 1024 * 1024);
+        cache->setStore(&store);
+    }
+    return *cache;
+}
+
+static val thumbnailValue(const ThumbnailCache::Entry &entry) {
+    val r = val::object();
+    r.set("image", imageData(entry.pixels.data(), entry.width, entry.height));
+    r.set("info", entry.is_game ? saveInfoValue(entry.info) : val::null());
+    return r;
+}
+
+static val renderThumbnails(val files, unsigned width, unsigned height) {
+    // Like screenshotSaveFile(), for a list of {data, compressed} files at
+    // once, each shrunk to width x height. Returns a matching list of
+    // {image, info} with an ImageData and getSaveInfo() result, or null for
+    // files that can't be loaded. Files we've already seen come from the
+    // thumbnail cache; the rest run in waves on BatchHost instances, one
+    // per thread.
+    ThumbnailCache &cache = getThumbnailCache();
+    width = std::max(RGBDraw::SCREEN_WIDTH / RGBDraw::MAX_DOWNSCALE,
+                     std::min(width, RGBDraw::SCREEN_WIDTH));
+    height = std::max(RGBDraw::SCREEN_HEIGHT / RGBDraw::MAX_DOWNSCALE,
+                      std::min(height, RGBDraw::SCREEN_HEIGHT));
+
+    const unsigned count = files["length"].as<unsigned>();
+    const unsigned threads = BatchHost::getMaxThreads();
+    std::unique_ptr<BatchHost> host; // Only if something misses
+
+    val results = val::array();
+    std::vector<unsigned> wave;  // File index for each busy instance
+    std::vector<uint64_t> keys;  // Cache key for each busy instance
+    std::vector<uint32_t> pixels(width * height);
+    static uint8_t data[DOSFilesystem::MAX_FILESIZE];
+
+    auto runWave = [&]() {
+        std::vector<uint32_t> frames(wave.size());
+        for (unsigned i = 0; i < wave.size(); i++) {
+            frames[i] = host->getInstance(i).output.getFrameCount();
+        }
+        host->run(1, threads);
+        for (unsigned i = 0; i < wave.size(); i++) {
+            Hardware &hw = host->getInstance(i);
+            if (hw.output.getFrameCount() == frames[i]) {
+                // Exited without drawing anything, so there's no
+                // thumbnail to return or cache, like screenshotSaveFile()
+                results.set(wave[i], val::null());
+                hw.exec("");
+                continue;
+            }
+            hw.output.draw.downscale(pixels.data(), width, height);
+            ROSavedGame *game =
+                hw.fs.save.file.size == sizeof(ROSavedGame)
+                    ? reinterpret_cast<ROSavedGame *>(hw.fs.save.buffer)
+                    : nullptr;
+            const ThumbnailCache::Entry *entry =
+                cache.insert(keys[i], game, width, height, pixels.data());
+            results.set(wave[i], thumbnailValue(*entry));
+            hw.exec("");
+        }
+        wave.clear();
+        keys.clear();
+    };
+
+    for (unsigned f = 0; f < count; f++) {
+        val file = files[f];
+        FileInfo save = {nullptr, data, 0};
+        if (!copySaveFile(file["data"], file["compressed"].as<bool>(), save,
+                          data)) {
+            results.set(f, val::null());
+            continue;
+        }
+
+        const uint64_t key =
+            ThumbnailCache::keyFor(data, save.size, width, height);
+        const ThumbnailCache::Entry *entry = cache.find(key);
+        if (entry) {
+            results.set(f, thumbnailValue(*entry));
+            continue;
+        }
+
+        if (!host) {
+            host.reset(new BatchHost(colorTable));
+            for (unsigned i = 0; i < threads; i++) {
+                host->addInstance("");
+            }
+        }
+        Hardware &hw = host->getInstance(wave.size());
+        memcpy(hw.fs.save.buffer, data, save.size);
+        hw.fs.save.file.size = save.size;
+        if (!hw.loadGame() && !hw.loadChipDocumentation()) {
+            hw.exec("");
+            results.set(f, val::null());
+            continue;
+        }
+
+        wave.push_back(f);
+        keys.push_back(key);
+        if (wave.size() == threads) {
+            runWave();
+        }
+    }
+    if (!wave.empty()) {
+        runWave();
+    }
+    return results;
+}
+
+static val getThumbnailCacheStats() {
+    ThumbnailCache &cache = getThumbnailCache();
+    val r = val::object();
+    r.set("bytes", double(cache.getBytes()));
+    r.set("count", double(cache.getCount()));
+    r.set("hits", double(cache.getHits()));
+    r.set("misses", double(cache.getMisses()));
+    return r;
+}
+
+static void setThumbnailCacheBudget(uint32_t max_bytes) {
+    getThumbnailCache().setBudget(max_bytes);
 }
 
 static val packSaveFile() {
+    Hardware &hw = getMain().hw;
+    TinySave &tinySave = getTinySave();
+
     tinySave.compress(hw.fs.save.file);
     return val(typed_memory_view(tinySave.size, tinySave.buffer));
 }
 
+static bool startPackSaveFile(DOSFilesystem::SaveSlot slot, bool fast) {
+    // Begin compressing a copy of a save slot without holding up a frame.
+    // Fast is for autosaves, the slower level makes shorter share links.
+    // Returns false if another pack hasn't finished yet.
+    Hardware &hw = getMain().hw;
+    TinySave &tinySave = getTinySave();
+
+    const FileInfo &file = hw.fs.getSaveSlot(slot).file;
+    return tinySave.beginCompress(file.data, file.size,
+                                  fast ? TinySave::FAST : TinySave::SMALL);
+}
+
+static val continuePackSaveFile(uint32_t max_bytes) {
+    // Compress up to max_bytes more of the input. Returns null until done,
+    // then the same kind of packed file as packSaveFile(). Only valid after
+    // startPackSaveFile() succeeded, until the result comes back.
+    TinySave &tinySave = getTinySave();
+
+    if (!tinySave.continueCompress(max_bytes)) {
+        return val::null();
+    }
+    return val(typed_memory_view(tinySave.size, tinySave.buffer));
+}
+
 static void setCheatsEnabled(bool enable) {
     // Set a byte in JOYFILE to enable cheats. Game must restart to take effect.
     // This enables the CTRL-E key (via ASCII \x05) as a toggle to walk through
     // walls in the game. It disables collision detection with walls, but does
     // not disable sentries. It's possible to use this to cheat past most but
     // not all puzzles in the game for debug purposes.
-    hw.fs.config.joyfile.setCheatsEnabled(enable);
+    applyInput(InputEvent(InputEvent::CHEATS, enable));
 }
 
 static val getGameMemory() {
     // Get a JS representation of the current ROData, with direct views into
     // memory. Just for exploration/fun currently.
+    Hardware &hw = getMain().hw;
 
     ROData d;
     if (!hw.process || !d.fromProcess(hw.process)) {
@@ -345,7 +1250,8 @@ EMSCRIPTEN_BINDINGS(engine) {
     constant("MAX_FILESIZE", (unsigned)DOSFilesystem::MAX_FILESIZE);
     constant("MEM_SIZE", (unsigned)Hardware::MEM_SIZE);
     constant("CPU_CLOCK_HZ", (unsigned)OutputQueue::CPU_CLOCK_HZ);
-    constant("AUDIO_HZ", (unsigned)OutputQueue::AUDIO_HZ);
+    constant("MIN_AUDIO_HZ", (unsigned)OutputQueue::MIN_AUDIO_HZ);
+    constant("MAX_AUDIO_HZ", (unsigned)OutputQueue::MAX_AUDIO_HZ);
     constant("SCREEN_WIDTH", (unsigned)RGBDraw::SCREEN_WIDTH);
     constant("SCREEN_HEIGHT", (unsigned)RGBDraw::SCREEN_HEIGHT);
     constant("SCREEN_TILE_SIZE", (unsigned)ColorTable::SCREEN_TILE_SIZE);
@@ -355,8 +1261,30 @@ EMSCRIPTEN_BINDINGS(engine) {
         .value("NOT_SUPPORTED", SaveStatus::NOT_SUPPORTED)
         .value("BLOCKED", SaveStatus::BLOCKED);
 
+    enum_<DOSFilesystem::SaveSlot>("SaveSlot")
+        .value("USER", DOSFilesystem::USER_SLOT)
+        .value("AUTO", DOSFilesystem::AUTO_SLOT);
+
+    enum_<SpeakerSynthesis>("SpeakerSynthesis")
+        .value("IIR", SPEAKER_SYNTH_IIR)
+        .value("BLEP", SPEAKER_SYNTH_BLEP);
+
+    enum_<ChipSimMode>("ChipSimMode")
+        .value("TRANSLATED", CHIP_SIM_TRANSLATED)
+        .value("NATIVE", CHIP_SIM_NATIVE)
+        .value("CHECK", CHIP_SIM_CHECK);
+
     function("exec", &exec);
     function("setSpeed", &setSpeed);
+    function("setSpeakerSynthesis", &setSpeakerSynthesis);
+    function("benchmarkSound", &benchmarkSound);
+    function("setAudioRate", &setAudioRate);
+    function("startSoundTrace", &startSoundTrace);
+    function("stopSoundTrace", &stopSoundTrace);
+    function("renderSoundTrace", &renderSoundTrace);
+    function("checkSoundTrace", &checkSoundTrace);
+    function("benchmarkSoundTrace", &benchmarkSoundTrace);
+    function("benchmarkBatch", &benchmarkBatch);
     function("pressKey", &pressKey);
     function("setJoystickAxes", &setJoystickAxes);
     function("setJoystickButton", &setJoystickButton);
@@ -364,17 +1292,47 @@ EMSCRIPTEN_BINDINGS(engine) {
     function("setMouseButton", &setMouseButton);
     function("endMouseTracking", &endMouseTracking);
     function("saveGame", &saveGame);
+    function("saveGameToSlot", &saveGameToSlot);
     function("loadGame", &loadGame);
     function("loadChip", &loadChip);
+    function("startMovieRecording", &startMovieRecording);
+    function("stopMovieRecording", &stopMovieRecording);
+    function("replayMovie", &replayMovie);
+    function("verifyMovie", &verifyMovie);
+    function("searchPuzzle", &searchPuzzle);
+    function("circuitTruthTable", &circuitTruthTable);
+    function("startStateTrace", &startStateTrace);
+    function("stopStateTrace", &stopStateTrace);
+    function("compareStateTraces", &compareStateTraces);
+    function("setChipSimMode", &setChipSimMode);
+    function("getChipSimStats", &getChipSimStats);
+    function("checkChipSim", &checkChipSim);
+    function("saveSnapshot", &saveSnapshot);
+    function("loadSnapshot", &loadSnapshot);
+    function("setRewindBudget", &setRewindBudget);
+    function("rewind", &rewindFrames);
+    function("getRewindInfo", &getRewindInfo);
+    function("getStartupTimes", &getStartupTimes);
+    function("getFileLoads", &getFileLoads);
     function("getMemory", &getMemory);
+    function("getDirtyPages", &getDirtyPages);
+    function("clearDirtyPages", &clearDirtyPages);
     function("getCompressionDictionary", &getCompressionDictionary);
-    function("getStaticFiles", &getStaticFiles);
+    function("getStaticFileNames", &getStaticFileNames);
+    function("getStaticFile", &getStaticFile);
     function("getJoyFile", &getJoyFile);
     function("getSaveFile", &getSaveFile);
+    function("getSaveSlot", &getSaveSlot);
     function("setSaveFile", &setSaveFile);
+    function("getSaveInfo", &getSaveInfo);
     function("screenshotSaveFile", &screenshotSaveFile);
+    function("renderThumbnails", &renderThumbnails);
+    function("getThumbnailCacheStats", &getThumbnailCacheStats);
+    function("setThumbnailCacheBudget", &setThumbnailCacheBudget);
     function("setCheatsEnabled", &setCheatsEnabled);
     function("packSaveFile", &packSaveFile);
+    function("startPackSaveFile", &startPackSaveFile);
+    function("continuePackSaveFile", &continuePackSaveFile);
     function("getGameMemory", &getGameMemory);
     function("getColorMemory", &getColorMemory);
 }
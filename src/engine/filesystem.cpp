@@ -2,6 +2,7 @@
 #include "sbt86.h"
 #include <algorithm>
 #include <emscripten.h>
+#include <mutex>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -17,15 +18,78 @@ DOSFilesystem::DOSFilesystem() {
 
     memset(&save, 0, sizeof save);
     save.file.data = save.buffer;
+    memset(&autosave, 0, sizeof autosave);
+    autosave.file.data = autosave.buffer;
+    save_target = USER_SLOT;
+    load_total = 0;
 
     reset();
 }
 
 void DOSFilesystem::reset() { memset(openFiles, 0, sizeof openFiles); }
 
+void DOSFilesystem::saveState(State &state) {
+    state.joyfile = config.joyfile;
+    state.save_size = save.file.size;
+    state.save_open_for_write = save.openForWrite;
+    state.autosave_size = autosave.file.size;
+    state.autosave_open_for_write = autosave.openForWrite;
+    memcpy(state.fileOffsets, fileOffsets, sizeof fileOffsets);
+
+    // File pointers all refer to static data or to this instance
+    for (unsigned fd = 0; fd < MAX_OPEN_FILES; fd++) {
+        const FileInfo *file = openFiles[fd];
+        if (!file) {
+            state.openFiles[fd] = STATE_FILE_CLOSED;
+        } else if (file == &config.file) {
+            state.openFiles[fd] = STATE_FILE_CONFIG;
+        } else if (file == &save.file) {
+            state.openFiles[fd] = STATE_FILE_SAVE;
+        } else if (file == &autosave.file) {
+            state.openFiles[fd] = STATE_FILE_AUTOSAVE;
+        } else {
+            state.openFiles[fd] = STATE_FILE_STATIC + FileInfo::getIndex(file);
+        }
+    }
+}
+
+void DOSFilesystem::restoreState(const State &state) {
+    config.joyfile = state.joyfile;
+    save.file.size = state.save_size;
+    save.openForWrite = state.save_open_for_write;
+    autosave.file.size = state.autosave_size;
+    autosave.openForWrite = state.autosave_open_for_write;
+    memcpy(fileOffsets, state.fileOffsets, sizeof fileOffsets);
+
+    for (unsigned fd = 0; fd < MAX_OPEN_FILES; fd++) {
+        switch (state.openFiles[fd]) {
+        case STATE_FILE_CLOSED:
+            openFiles[fd] = nullptr;
+            break;
+        case STATE_FILE_CONFIG:
+            openFiles[fd] = &config.file;
+            break;
+        case STATE_FILE_SAVE:
+            openFiles[fd] = &save.file;
+            break;
+        case STATE_FILE_AUTOSAVE:
+            openFiles[fd] = &autosave.file;
+            break;
+        default:
+            openFiles[fd] =
+                FileInfo::fromIndex(state.openFiles[fd] - STATE_FILE_STATIC);
+            break;
+        }
+        if (openFiles[fd]) {
+            beginLoad(fd, emscripten_get_now());
+        }
+    }
+}
+
 int DOSFilesystem::open(const char *name) {
     int fd = allocateFD();
     const FileInfo *file;
+    double start = emscripten_get_now();
 
     if (verbose_filesystem_info) {
         printf("FILE, opening '%s'\n", name);
@@ -36,8 +100,9 @@ int DOSFilesystem::open(const char *name) {
          * Save file
          */
 
-        save.openForWrite = false;
-        file = &save.file;
+        SaveBuffer &slot = getSaveSlot(save_target);
+        slot.openForWrite = false;
+        file = &slot.file;
 
     } else if (!strcmp(name, SBT_JOYFILE)) {
         /*
@@ -60,6 +125,7 @@ int DOSFilesystem::open(const char *name) {
 
     openFiles[fd] = file;
     fileOffsets[fd] = 0;
+    beginLoad(fd, start);
     return fd;
 }
 
@@ -73,9 +139,10 @@ int DOSFilesystem::create(const char *name) {
 
     if (!strcmp(name, SBT_SAVE_FILE_NAME)) {
 
-        save.file.size = 0;
-        save.openForWrite = true;
-        file = &save.file;
+        SaveBuffer &slot = getSaveSlot(save_target);
+        slot.file.size = 0;
+        slot.openForWrite = true;
+        file = &slot.file;
 
     } else {
         fprintf(stderr, "FILE, failed to open '%s' for writing\n", name);
@@ -84,9 +151,29 @@ int DOSFilesystem::create(const char *name) {
 
     openFiles[fd] = file;
     fileOffsets[fd] = 0;
+    beginLoad(fd, emscripten_get_now());
     return fd;
 }
 
+void DOSFilesystem::beginLoad(uint16_t fd, double start) {
+    // Only static files have names of their own. The others are named here
+    // rather than copied from emulated memory, so the records can keep them.
+    const FileInfo *file = openFiles[fd];
+    LoadRecord &load = openLoads[fd];
+    if (file == &config.file) {
+        load.name = SBT_JOYFILE;
+    } else if (file == &save.file || file == &autosave.file) {
+        load.name = SBT_SAVE_FILE_NAME;
+    } else {
+        load.name = file->name;
+    }
+    load.calls = 0;
+    load.bytes = 0;
+    load.whole = false;
+    openTimes[fd] = emscripten_get_now();
+    load.lookup_msec = openTimes[fd] - start;
+}
+
 void DOSFilesystem::close(uint16_t fd) {
     assert(fd < MAX_OPEN_FILES && "Closing an invalid file descriptor");
     assert(openFiles[fd] && "Closing a file which is not open");
@@ -95,6 +182,10 @@ void DOSFilesystem::close(uint16_t fd) {
         EM_ASM(Module.onSaveFileWrite(););
     }
 
+    LoadRecord &load = openLoads[fd];
+    load.open_msec = emscripten_get_now() - openTimes[fd];
+    loads[load_total++ % MAX_LOAD_RECORDS] = load;
+
     openFiles[fd] = 0;
 }
 
@@ -114,30 +205,57 @@ uint16_t DOSFilesystem::read(uint16_t fd, void *buffer, uint16_t length) {
     memcpy(buffer, file->data + offset, actual_length);
 
     fileOffsets[fd] += actual_length;
+    openLoads[fd].calls++;
+    openLoads[fd].bytes += actual_length;
     return actual_length;
 }
 
+int DOSFilesystem::readWhole(uint16_t fd, void *buffer, uint16_t length) {
+    assert(fd < MAX_OPEN_FILES && "Reading an invalid file descriptor");
+    const FileInfo *file = openFiles[fd];
+
+    if (!file || file == &config.file || file == &save.file ||
+        file == &autosave.file || fileOffsets[fd] != 0 ||
+        length < file->size) {
+        return -1;
+    }
+
+    if (verbose_filesystem_info) {
+        printf("FILE, read all %d bytes of '%s'\n", file->size, file->name);
+    }
+    memcpy(buffer, file->data, file->size);
+
+    fileOffsets[fd] = file->size;
+    openLoads[fd].calls++;
+    openLoads[fd].bytes += file->size;
+    openLoads[fd].whole = true;
+    return file->size;
+}
+
 uint16_t DOSFilesystem::write(uint16_t fd, const void *buffer,
                               uint16_t length) {
     const FileInfo *file = openFiles[fd];
 
     assert(fd < MAX_OPEN_FILES && "Writing an invalid file descriptor");
     assert(file && "Writing a file which is not open");
-    assert(file == &save.file &&
+    assert((file == &save.file || file == &autosave.file) &&
            "Writing a file that isn't the saved game file");
 
-    uint32_t offset = std::min<unsigned>(sizeof save.buffer, fileOffsets[fd]);
+    SaveBuffer &slot = file == &autosave.file ? autosave : save;
+    uint32_t offset = std::min<unsigned>(sizeof slot.buffer, fileOffsets[fd]);
     uint16_t actual_length =
-        std::min<unsigned>(length, sizeof save.buffer - offset);
+        std::min<unsigned>(length, sizeof slot.buffer - offset);
 
     if (verbose_filesystem_info) {
         printf("FILE, write %d(%d) bytes at %d\n", length, actual_length,
                offset);
     }
-    memcpy(save.buffer + offset, buffer, actual_length);
+    memcpy(slot.buffer + offset, buffer, actual_length);
 
     fileOffsets[fd] = offset + actual_length;
-    save.file.size = fileOffsets[fd];
+    slot.file.size = fileOffsets[fd];
+    openLoads[fd].calls++;
+    openLoads[fd].bytes += actual_length;
     return actual_length;
 }
 
@@ -154,35 +272,83 @@ uint16_t DOSFilesystem::allocateFD() {
     return fd;
 }
 
-const FileInfo *CompressedFileInfo::lazyDecompress() {
-    // Decompress files on first access
-    if (!cache->name) {
+const FileInfo *CompressedFileInfo::unpack(unsigned i) {
+    // Decompress a file on first access. Names and sizes are already in the
+    // cache; only the data pointer is filled in here.
+    //
+    // BatchHost workers open files too. One lock covers the shared
+    // decompression context and the cache, and it's only taken when a file
+    // is opened or a state is restored.
+    static std::mutex lock;
+    std::lock_guard<std::mutex> guard(lock);
+
+    assert(i < count);
+    FileInfo &file = cache[i];
+
+    if (!file.data) {
+        static ZSTD_DCtx *dctx = ZSTD_createDCtx();
+        static ZSTD_DDict *ddict =
+            dictionary_size ? ZSTD_createDDict(dictionary, dictionary_size)
+                            : nullptr;
+
+        const CompressedFileInfo &item = index[i];
+        uint8_t *data = new uint8_t[item.size];
         size_t result =
-            ZSTD_decompress(unpacked, unpacked_size, packed, packed_size);
-        assert(result == unpacked_size);
-
-        const CompressedFileInfo *index_item = index;
-        FileInfo *cache_item = cache;
-        while (index_item->name) {
-            cache_item->name = index_item->name;
-            cache_item->data = unpacked + index_item->offset;
-            cache_item->size = index_item->size;
-            cache_item++;
-            index_item++;
-        }
+            ddict ? ZSTD_decompress_usingDDict(dctx, data, item.size,
+                                               packed + item.offset,
+                                               item.packed_size, ddict)
+                  : ZSTD_decompressDCtx(dctx, data, item.size,
+                                        packed + item.offset, item.packed_size);
+        assert(result == item.size);
+        (void)result;
+        file.data = data;
     }
-    return cache;
+    return &file;
 }
 
-const FileInfo *FileInfo::lookup(const char *name) {
-    for (const FileInfo *cached = getAllFiles(); cached->name; cached++) {
-        if (!strcasecmp(name, cached->name)) {
-            return cached;
+uint32_t CompressedFileInfo::hashName(uint32_t seed, const char *name) {
+    // Must match hash_name() in fs-packer.py
+    uint32_t h = seed ? seed : 0x01000193;
+    for (; *name; name++) {
+        uint8_t c = *name;
+        if (c >= 'a' && c <= 'z') {
+            c -= 'a' - 'A';
         }
+        h = (h * 0x01000193) ^ c;
     }
-    return nullptr;
+
+    // MurmurHash3's fmix32, so every bit of the name reaches the low bits
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+int CompressedFileInfo::find(const char *name) {
+    // The hash picks exactly one candidate for any name. It could still be
+    // the wrong file if the name isn't in the pack at all.
+    if (!count) {
+        return -1;
+    }
+    int32_t d = hash_table[hashName(0, name) % count];
+    uint32_t slot = d < 0 ? -1 - d : hashName(d, name) % count;
+    unsigned i = hash_slots[slot];
+    return strcasecmp(name, cache[i].name) ? -1 : i;
+}
+
+const FileInfo *FileInfo::lookup(const char *name) {
+    int i = CompressedFileInfo::find(name);
+    return i < 0 ? nullptr : CompressedFileInfo::unpack(i);
+}
+
+const FileInfo *FileInfo::fromIndex(unsigned index) {
+    return CompressedFileInfo::unpack(index);
 }
 
-const FileInfo *FileInfo::getAllFiles() {
-    return CompressedFileInfo::lazyDecompress();
+unsigned FileInfo::getIndex(const FileInfo *file) {
+    assert(file >= CompressedFileInfo::cache &&
+           file < CompressedFileInfo::cache + CompressedFileInfo::count);
+    return file - CompressedFileInfo::cache;
 }
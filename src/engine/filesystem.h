@@ -7,25 +7,41 @@ struct FileInfo {
     const uint8_t *data;
     uint32_t size;
 
+    // Files are unpacked individually, the first time they're looked up.
+    // These can be called from any thread.
     static const FileInfo *lookup(const char *name);
-    static const FileInfo *getAllFiles();
+    static const FileInfo *fromIndex(unsigned index);
+    static unsigned getIndex(const FileInfo *file);
 };
 
+// Packed file index, generated by fs-packer.py. Each file is a separate
+// zstd frame, all sharing one dictionary.
 struct CompressedFileInfo {
     const char *name;
     uint32_t offset;
+    uint32_t packed_size;
     uint32_t size;
 
-    static const FileInfo *lazyDecompress();
+    static const FileInfo *unpack(unsigned index);
+    static int find(const char *name);
+    static unsigned getCount() { return count; }
+    static const char *getName(unsigned i) { return index[i].name; }
 
   private:
+    friend struct FileInfo;
+
     static const uint8_t *const packed;
-    static uint8_t *const unpacked;
-    static const uint32_t packed_size;
-    static const uint32_t unpacked_size;
+    static const uint8_t *const dictionary;
+    static const uint32_t dictionary_size;
 
     static const CompressedFileInfo *const index;
     static FileInfo *const cache;
+    static const uint32_t count;
+
+    // Minimal perfect hash of the upper-cased names, from fs-packer.py
+    static const int32_t *const hash_table;
+    static const uint16_t *const hash_slots;
+    static uint32_t hashName(uint32_t seed, const char *name);
 };
 
 class DOSFilesystem {
@@ -33,13 +49,43 @@ class DOSFilesystem {
     static const unsigned MAX_OPEN_FILES = 16;
     static const unsigned MAX_FILESIZE = 0x10000;
 
+    // The game only knows one saved game file name. Each slot is a separate
+    // buffer it can be pointed at, so autosaves don't replace the user's
+    // save. Only the user slot reports writes to Javascript.
+    enum SaveSlot {
+        USER_SLOT,
+        AUTO_SLOT,
+        NUM_SAVE_SLOTS,
+    };
+
     DOSFilesystem();
     void reset();
 
+    // Everything except the save slots' contents, for save-states. Open
+    // files are stored as indices rather than pointers, so a state can be
+    // restored into a different instance.
+    struct State {
+        ROJoyfile joyfile;
+        uint32_t save_size;
+        bool save_open_for_write;
+        uint32_t autosave_size;
+        bool autosave_open_for_write;
+        uint16_t openFiles[MAX_OPEN_FILES];
+        uint32_t fileOffsets[MAX_OPEN_FILES];
+    };
+
+    void saveState(State &state);
+    void restoreState(const State &state);
+
     int open(const char *name);
     int create(const char *name);
     void close(uint16_t fd);
     uint16_t read(uint16_t fd, void *buffer, uint16_t length);
+
+    // Bulk read, for when the game asks for all of a static file at once
+    // from its start. Copies the whole file and returns its size, or
+    // returns -1 without doing anything if the read is any other kind.
+    int readWhole(uint16_t fd, void *buffer, uint16_t length);
     uint16_t write(uint16_t fd, const void *buffer, uint16_t length);
 
     struct {
@@ -47,7 +93,7 @@ class DOSFilesystem {
         ROJoyfile joyfile;
     } config;
 
-    struct {
+    struct SaveBuffer {
         FileInfo file;
         bool openForWrite;
         uint8_t buffer[MAX_FILESIZE];
@@ -59,11 +105,62 @@ class DOSFilesystem {
         inline ROSavedGame &asGame() {
             return *reinterpret_cast<ROSavedGame *>(buffer);
         }
-    } save;
+    };
+
+    SaveBuffer save;
+    SaveBuffer autosave;
+
+    SaveBuffer &getSaveSlot(SaveSlot slot) {
+        return slot == AUTO_SLOT ? autosave : save;
+    }
+
+    // Slot used by files opened from now on
+    void setSaveTarget(SaveSlot slot) { save_target = slot; }
+
+    // Timing for recently closed files, for profiling level transitions.
+    // These aren't part of the saved State.
+    struct LoadRecord {
+        const char *name;
+        uint32_t calls; // Reads or writes
+        uint32_t bytes;
+        bool whole; // Read by readWhole()
+        double lookup_msec; // Includes unpacking, the first time
+        double open_msec;   // Until closed, including the game's parsing
+    };
+
+    static const unsigned MAX_LOAD_RECORDS = 32;
+
+    unsigned getLoadCount() const {
+        return load_total < MAX_LOAD_RECORDS ? load_total : MAX_LOAD_RECORDS;
+    }
+
+    // Oldest first
+    const LoadRecord &getLoad(unsigned i) const {
+        return loads[(load_total - getLoadCount() + i) % MAX_LOAD_RECORDS];
+    }
+
+    void clearLoads() { load_total = 0; }
 
   private:
+    enum StateFileIndex {
+        STATE_FILE_CLOSED,
+        STATE_FILE_CONFIG,
+        STATE_FILE_SAVE,
+        STATE_FILE_AUTOSAVE,
+        STATE_FILE_STATIC,
+    };
+
     uint16_t allocateFD();
 
+    SaveSlot save_target;
+
     const FileInfo *openFiles[MAX_OPEN_FILES];
     uint32_t fileOffsets[MAX_OPEN_FILES];
+
+    LoadRecord openLoads[MAX_OPEN_FILES];
+    double openTimes[MAX_OPEN_FILES];
+    LoadRecord loads[MAX_LOAD_RECORDS];
+    uint32_t load_total;
+
+    void beginLoad(uint16_t fd, double start);
 };
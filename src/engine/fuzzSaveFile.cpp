@@ -0,0 +1,66 @@
+#include "hardware.h"
+#include "roData.h"
+#include "snapshot.h"
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+
+// libFuzzer target for saved games, built natively with "make fuzz".
+//
+// Loading a game normally means an exec(), which unpacks the whole EXE
+// image. Instead we exec each program once at startup and snapshot it before
+// it has run at all. Each input resets to that snapshot, then replaces the
+// save file and runs a bounded number of frames. The reset only looks at
+// memory pages the last input marked dirty, and rewrites the ones that
+// changed. The backbuffer and save slots are compared in full.
+
+SBT_DECL_PROCESS(LabEXE);
+SBT_DECL_PROCESS(GameEXE);
+
+static const unsigned FRAMES_PER_INPUT = 30;
+
+// Processes can also return without presenting a frame
+static const unsigned RUNS_PER_INPUT = FRAMES_PER_INPUT * 64;
+
+static ColorTable colorTable;
+static OutputInterface output(colorTable);
+static Hardware hw(output);
+SBT_STATIC_PROCESS(hw, LabEXE);
+SBT_STATIC_PROCESS(hw, GameEXE);
+
+static HardwareSnapshot lab_start;
+static HardwareSnapshot game_start;
+static uint8_t save_file[sizeof(ROSavedGame)];
+
+extern "C" int LLVMFuzzerInitialize(int *, char ***) {
+    hw.exec("lab.exe", "99");
+    hw.saveSnapshot(lab_start);
+    hw.exec("game.exe", "99");
+    hw.saveSnapshot(game_start, &lab_start);
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    // Inputs are padded or truncated to the size of a saved game, so they
+    // all get past loadGame()'s checks. The world ID picks the program.
+    memset(save_file, 0, sizeof save_file);
+    memcpy(save_file, data, std::min(size, sizeof save_file));
+    const char *process =
+        reinterpret_cast<ROSavedGame *>(save_file)->getProcessName();
+    if (!process) {
+        return 0;
+    }
+
+    hw.loadSnapshot(strcmp(process, "lab.exe") ? game_start : lab_start);
+    memcpy(hw.fs.save.buffer, save_file, sizeof save_file);
+    hw.fs.save.file.size = sizeof save_file;
+
+    const uint32_t first_frame = output.getFrameCount();
+    for (unsigned runs = 0;
+         hw.process && runs < RUNS_PER_INPUT &&
+         output.getFrameCount() - first_frame < FRAMES_PER_INPUT;
+         runs++) {
+        hw.process->run();
+    }
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "hardware.h"
 #include "sbt86.h"
+#include "snapshot.h"
 #include <algorithm>
 #include <emscripten.h>
 #include <stdio.h>
@@ -9,8 +10,70 @@ static const bool verbose_process_info = false;
 
 Hardware::Hardware(OutputInterface &output) : output(output) {
     memset(mem, 0, MEM_SIZE);
+    markDirty(0, MEM_SIZE);
     process = 0;
     port61 = 0;
+    snapshot_base = 0;
+}
+
+void Hardware::markDirty(uint32_t offset, uint32_t size) {
+    if (size == 0 || offset >= MEM_SIZE) {
+        return;
+    }
+    // Not std::min, which would need MEM_SIZE to have storage
+    uint32_t end = offset + size > MEM_SIZE ? MEM_SIZE : offset + size;
+    uint32_t first = offset >> DIRTY_PAGE_SHIFT;
+    uint32_t last = (end - 1) >> DIRTY_PAGE_SHIFT;
+    memset(dirty_pages + first, DIRTY_ALL, last - first + 1);
+}
+
+void Hardware::clearDirtyPages(uint8_t consumer) {
+#if ENGINE_DIRTY_PAGES
+    for (unsigned i = 0; i < NUM_DIRTY_PAGES; i++) {
+        dirty_pages[i] &= ~consumer;
+    }
+#else
+    // Stores aren't tracked, so nothing is ever known to be clean
+    (void)consumer;
+#endif
+}
+
+bool Hardware::isDirty(uint32_t offset, uint32_t size,
+                       uint8_t consumer) const {
+    if (size == 0 || offset >= MEM_SIZE) {
+        return false;
+    }
+    uint32_t end = offset + size > MEM_SIZE ? MEM_SIZE : offset + size;
+    for (uint32_t page = offset >> DIRTY_PAGE_SHIFT;
+         page <= (end - 1) >> DIRTY_PAGE_SHIFT; page++) {
+        if (dirty_pages[page] & consumer) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Hardware::getDirtyPages(uint8_t consumer, uint32_t page_size,
+                             uint8_t *flags) const {
+    const unsigned per_page = page_size >> DIRTY_PAGE_SHIFT;
+    assert(per_page && (per_page << DIRTY_PAGE_SHIFT) == page_size);
+    for (unsigned i = 0; i < NUM_DIRTY_PAGES / per_page; i++) {
+        uint8_t any = 0;
+        for (unsigned j = 0; j < per_page; j++) {
+            any |= dirty_pages[i * per_page + j];
+        }
+        flags[i] = any & consumer;
+    }
+}
+
+SBTProcess *Hardware::findProcess(const char *program) {
+    for (std::vector<SBTProcess *>::iterator i = process_vec.begin();
+         i != process_vec.end(); i++) {
+        if (!strcasecmp(program, (*i)->getFilename())) {
+            return *i;
+        }
+    }
+    return nullptr;
 }
 
 void Hardware::exec(const char *program, const char *args) {
@@ -22,16 +85,9 @@ void Hardware::exec(const char *program, const char *args) {
     input.clear();
 
     if (*program) {
-        for (std::vector<SBTProcess *>::iterator i = process_vec.begin();
-             i != process_vec.end(); i++) {
-            const char *filename = (*i)->getFilename();
-            if (!strcasecmp(program, filename)) {
-                process = *i;
-                process->exec(args);
-                return;
-            }
-        }
-        assert(0 && "Program not found in exec()");
+        process = findProcess(program);
+        assert(process && "Program not found in exec()");
+        process->exec(args);
 
     } else {
         // Empty program string: run no program.
@@ -51,7 +107,87 @@ bool Hardware::loadGame() {
     return false;
 }
 
-SaveStatus Hardware::saveGame() {
+void Hardware::saveSnapshot(HardwareSnapshot &snapshot,
+                            const HardwareSnapshot *previous) {
+    // If mem matched 'previous' when the snapshot bits were cleared, only
+    // the marked pages can differ from it. Otherwise compare every page.
+    uint8_t dirty[MEM_SIZE / PageSnapshot::PAGE_SIZE];
+    const uint8_t *hint = nullptr;
+    if (previous && snapshot_base &&
+        previous->mem.getId() == snapshot_base) {
+        getDirtyPages(DIRTY_SNAPSHOT, PageSnapshot::PAGE_SIZE, dirty);
+        hint = dirty;
+    }
+    snapshot.new_pages = snapshot.mem.capture(
+        mem, MEM_SIZE, previous ? &previous->mem : nullptr, hint);
+    snapshot_base = snapshot.mem.getId();
+    clearDirtyPages(DIRTY_SNAPSHOT);
+
+    snapshot.new_pages += snapshot.backbuffer.capture(
+        reinterpret_cast<uint8_t *>(output.draw.backbuffer),
+        sizeof output.draw.backbuffer,
+        previous ? &previous->backbuffer : nullptr);
+    snapshot.new_pages += snapshot.save_buffer.capture(
+        fs.save.buffer, sizeof fs.save.buffer,
+        previous ? &previous->save_buffer : nullptr);
+    snapshot.new_pages += snapshot.autosave_buffer.capture(
+        fs.autosave.buffer, sizeof fs.autosave.buffer,
+        previous ? &previous->autosave_buffer : nullptr);
+
+    saveState(snapshot.state);
+}
+
+void Hardware::saveState(HardwareState &state) {
+    state.process = process ? process->getFilename() : nullptr;
+    if (process) {
+        process->saveState(state.process_state);
+    }
+    fs.saveState(state.fs);
+    state.input = input;
+    output.saveState(state.output);
+    state.port61 = port61;
+}
+
+void Hardware::loadSnapshot(const HardwareSnapshot &snapshot) {
+    // Going back to the snapshot mem last matched, as the fuzzer and rewind
+    // do over and over, only the marked pages can differ
+    uint8_t dirty[MEM_SIZE / PageSnapshot::PAGE_SIZE];
+    const uint8_t *hint = nullptr;
+    if (snapshot_base && snapshot.mem.getId() == snapshot_base) {
+        getDirtyPages(DIRTY_SNAPSHOT, PageSnapshot::PAGE_SIZE, dirty);
+        hint = dirty;
+    }
+    uint8_t changed[MEM_SIZE / PageSnapshot::PAGE_SIZE] = {};
+    snapshot.mem.restore(mem, MEM_SIZE, changed, hint);
+    for (unsigned i = 0; i < sizeof changed; i++) {
+        if (changed[i]) {
+            markDirty(i * PageSnapshot::PAGE_SIZE, PageSnapshot::PAGE_SIZE);
+        }
+    }
+    snapshot_base = snapshot.mem.getId();
+    clearDirtyPages(DIRTY_SNAPSHOT);
+    snapshot.backbuffer.restore(
+        reinterpret_cast<uint8_t *>(output.draw.backbuffer),
+        sizeof output.draw.backbuffer);
+    snapshot.save_buffer.restore(fs.save.buffer, sizeof fs.save.buffer);
+    snapshot.autosave_buffer.restore(fs.autosave.buffer,
+                                     sizeof fs.autosave.buffer);
+    loadState(snapshot.state);
+}
+
+void Hardware::loadState(const HardwareState &state) {
+    process = state.process ? findProcess(state.process) : nullptr;
+    assert(process || !state.process);
+    if (process) {
+        process->restoreState(state.process_state);
+    }
+    fs.restoreState(state.fs);
+    input = state.input;
+    output.restoreState(state.output);
+    port61 = state.port61;
+}
+
+SaveStatus Hardware::canSaveGame() {
     if (!process) {
         // Not running at all
         return SaveStatus::NOT_SUPPORTED;
@@ -67,15 +203,27 @@ SaveStatus Hardware::saveGame() {
         return SaveStatus::BLOCKED;
     }
 
-    fs.save.file.size = 0;
+    return SaveStatus::OK;
+}
+
+SaveStatus Hardware::saveGame(DOSFilesystem::SaveSlot slot) {
+    SaveStatus status = canSaveGame();
+    if (status != SaveStatus::OK) {
+        return status;
+    }
+
+    DOSFilesystem::SaveBuffer &save = fs.getSaveSlot(slot);
+    save.file.size = 0;
+    fs.setSaveTarget(slot);
     process->call(SBTADDR_SAVE_GAME_FUNC, process->reg);
+    fs.setSaveTarget(DOSFilesystem::USER_SLOT);
 
-    if (!fs.save.isGame()) {
+    if (!save.isGame()) {
         // File isn't the right size
         return SaveStatus::NOT_SUPPORTED;
     }
 
-    if (!fs.save.asGame().getProcessName()) {
+    if (!save.asGame().getProcessName()) {
         // File isn't something we know how to load.
         return SaveStatus::NOT_SUPPORTED;
     }
@@ -106,6 +254,7 @@ bool Hardware::loadChipDocumentation() {
     }
 
     world->objects.room[RO_OBJ_PLAYER] = RO_ROOM_CHIP_1;
+    markDirty(reinterpret_cast<uint8_t *>(world) - mem, sizeof *world);
     return true;
 }
 
@@ -266,15 +415,21 @@ SBTRegs Hardware::interrupt21(SBTRegs reg, SBTStack *stack) {
         fs.close(reg.bx);
         break;
 
-    case 0x3F: /* Read File */
-        reg.ax = fs.read(reg.bx, process->memSeg(reg.ds) + reg.dx, reg.cx);
+    case 0x3F: /* Read File */ {
+        // Whole static files take the bulk path: one copy straight from the
+        // unpacked pack, and one range of dirty pages.
+        uint8_t *dest = process->memSeg(reg.ds) + reg.dx;
+        int whole = fs.readWhole(reg.bx, dest, reg.cx);
+        reg.ax = whole >= 0 ? whole : fs.read(reg.bx, dest, reg.cx);
+        markDirty(dest - mem, reg.ax);
         reg.clearCF();
         if (verbose_process_info) {
             printf("FILE, reading %d bytes into %04x:%04x ", reg.ax, reg.ds,
                    reg.dx);
-            small_hexdump_and_newline(process->memSeg(reg.ds) + reg.dx, reg.ax);
+            small_hexdump_and_newline(dest, reg.ax);
         }
         break;
+    }
 
     case 0x40: /* Write file */
         reg.ax = fs.write(reg.bx, process->memSeg(reg.ds) + reg.dx, reg.cx);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "chipSim.h"
 #include "filesystem.h"
 #include "input.h"
 #include "output.h"
@@ -7,6 +8,13 @@
 #include <list>
 #include <vector>
 
+#ifndef ENGINE_DIRTY_PAGES
+#define ENGINE_DIRTY_PAGES 1
+#endif
+
+struct HardwareSnapshot;
+struct HardwareState;
+
 enum class SaveStatus {
     OK,
     NOT_SUPPORTED,
@@ -29,23 +37,90 @@ class Hardware {
     void requestLoadChip(SBTRegs reg);
 
     void exec(const char *program, const char *args = "");
+    SBTProcess *findProcess(const char *program);
+
+    SaveStatus
+    saveGame(DOSFilesystem::SaveSlot slot = DOSFilesystem::USER_SLOT);
 
-    SaveStatus saveGame();
+    // Whether saveGame() would get as far as running the save function
+    SaveStatus canSaveGame();
     bool loadGame();
     bool loadChip(uint8_t id);
     bool loadChipDocumentation();
 
+    // Save-states for the whole machine. Unlike saveGame(), these work in any
+    // process, as long as it isn't running. Pages that haven't changed since
+    // the previous snapshot are shared with it.
+    void saveSnapshot(HardwareSnapshot &snapshot,
+                      const HardwareSnapshot *previous = nullptr);
+    void loadSnapshot(const HardwareSnapshot &snapshot);
+
+    // Just the small parts of a save-state, without memory contents
+    void saveState(HardwareState &state);
+    void loadState(const HardwareState &state);
+
     static const uint32_t MEM_SIZE = 256 * 1024;
     uint8_t mem[MEM_SIZE];
 
+    // Write tracking for mem, one byte per 256-byte page. Translated code
+    // marks pages as it stores to them, and so does everything in Hardware
+    // that writes to mem. Writes from Javascript through views of mem aren't
+    // seen.
+    //
+    // Each consumer of the map owns one bit of every byte. A write sets all
+    // of them, and a consumer only ever clears its own bit, after it has
+    // caught up with the pages marked there. That way snapshots, the state
+    // hasher and scripts can each ask "what changed since I last looked"
+    // without clearing the map out from under each other.
+    static const unsigned DIRTY_PAGE_SHIFT = 8;
+    static const unsigned NUM_DIRTY_PAGES = MEM_SIZE >> DIRTY_PAGE_SHIFT;
+    uint8_t dirty_pages[NUM_DIRTY_PAGES];
+
+    static const uint8_t DIRTY_SNAPSHOT = 1 << 0;   // saveSnapshot()
+    static const uint8_t DIRTY_STATE_HASH = 1 << 1; // StateHasher::push()
+    static const uint8_t DIRTY_SCRIPT = 1 << 2;     // getDirtyPages() in JS
+    static const uint8_t DIRTY_ALL = 0xFF;
+
+    // Translated code calls these on every store. They cost a subtract, a
+    // shift and a byte store each. Builds with ENGINE_DIRTY_PAGES=0 skip
+    // the marking, and every page always reads as dirty instead, so
+    // snapshots compare all of memory and the state hasher rehashes it.
+    uint8_t *markDirty(uint8_t *ptr) {
+#if ENGINE_DIRTY_PAGES
+        dirty_pages[(ptr - mem) >> DIRTY_PAGE_SHIFT] = DIRTY_ALL;
+#endif
+        return ptr;
+    }
+    uint8_t *markDirty16(uint8_t *ptr) {
+#if ENGINE_DIRTY_PAGES
+        dirty_pages[(ptr + 1 - mem) >> DIRTY_PAGE_SHIFT] = DIRTY_ALL;
+#endif
+        return markDirty(ptr);
+    }
+    void markDirty(uint32_t offset, uint32_t size);
+    void clearDirtyPages(uint8_t consumer);
+
+    // Any page overlapping this range marked for this consumer?
+    bool isDirty(uint32_t offset, uint32_t size, uint8_t consumer) const;
+
+    // The map for one consumer at a coarser page size, one nonzero byte per
+    // page of 'page_size' bytes that has anything marked in it
+    void getDirtyPages(uint8_t consumer, uint32_t page_size,
+                       uint8_t *flags) const;
+
     DOSFilesystem fs;
     InputBuffer input;
     OutputInterface &output;
     SBTProcess *process;
+    ChipSim chips;
 
   private:
     std::vector<SBTProcess *> process_vec;
     uint8_t port61;
 
+    // Content ID of the memory snapshot that mem matched when the
+    // DIRTY_SNAPSHOT bits were last cleared, or zero
+    uint64_t snapshot_base;
+
     void exit(SBTProcess *exiting_process, uint8_t code);
 };
@@ -0,0 +1,446 @@
+#include "inputMovie.h"
+#include <algorithm>
+#include <string.h>
+
+// Movie format: a header with the configuration and save file, then one
+// record per event. Records are a type byte, then varint deltas of the step,
+// frame and clock since the previous record, then the event's parameters.
+// Step and frame deltas restart from zero after each successful anchor.
+static const uint8_t movie_magic[] = {'R', 'O', 'M', 'V'};
+static const uint8_t movie_version = 1;
+
+static void putVarint(std::vector<uint8_t> &out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(uint8_t(value));
+}
+
+static void putSigned(std::vector<uint8_t> &out, int32_t value) {
+    putVarint(out, (uint32_t(value) << 1) ^ uint32_t(value >> 31));
+}
+
+static void putBytes(std::vector<uint8_t> &out, const void *data,
+                     size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+static void putString(std::vector<uint8_t> &out, const std::string &str) {
+    putBytes(out, str.c_str(), str.size() + 1);
+}
+
+namespace {
+struct MovieReader {
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+    bool ok;
+
+    MovieReader(const uint8_t *data, size_t size)
+        : data(data), size(size), offset(0), ok(true) {}
+
+    bool done() const { return offset >= size; }
+
+    uint8_t byte() {
+        if (offset >= size) {
+            ok = false;
+            return 0;
+        }
+        return data[offset++];
+    }
+
+    uint32_t varint() {
+        uint32_t value = 0;
+        for (unsigned shift = 0; shift < 35; shift += 7) {
+            uint8_t b = byte();
+            value |= uint32_t(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                return value;
+            }
+        }
+        ok = false;
+        return 0;
+    }
+
+    int32_t svarint() {
+        uint32_t value = varint();
+        return int32_t((value >> 1) ^ -(value & 1));
+    }
+
+    void bytes(void *dest, size_t count) {
+        if (count > size - offset) {
+            ok = false;
+            return;
+        }
+        memcpy(dest, data + offset, count);
+        offset += count;
+    }
+
+    std::string string() {
+        const void *end = memchr(data + offset, 0, size - offset);
+        if (!end) {
+            ok = false;
+            return std::string();
+        }
+        std::string str(reinterpret_cast<const char *>(data + offset));
+        offset += str.size() + 1;
+        return str;
+    }
+};
+} // namespace
+
+InputEvent InputEvent::exec(const char *program, const char *args) {
+    InputEvent event(EXEC);
+    event.program = program;
+    event.args = args;
+    return event;
+}
+
+InputEvent InputEvent::saveFile(const FileInfo &file) {
+    InputEvent event(SAVE_FILE);
+    event.data.assign(file.data, file.data + file.size);
+    return event;
+}
+
+InputEvent InputEvent::joystickAxes(float x, float y) {
+    InputEvent event(JOYSTICK_AXES);
+    event.x = x;
+    event.y = y;
+    return event;
+}
+
+bool InputEvent::apply(Hardware &hw) const {
+    switch (type) {
+    case EXEC:
+        hw.output.clear();
+        hw.exec(program.c_str(), args.c_str());
+        return true;
+
+    case LOAD_GAME:
+        if (hw.loadGame()) {
+            hw.output.clear();
+            return true;
+        }
+        return false;
+
+    case LOAD_CHIP:
+        return hw.loadChip(a);
+
+    case SAVE_GAME:
+        return hw.saveGame(DOSFilesystem::SaveSlot(a)) == SaveStatus::OK;
+
+    case SAVE_FILE:
+        if (data.size() > sizeof hw.fs.save.buffer) {
+            return false;
+        }
+        memcpy(hw.fs.save.buffer, data.data(), data.size());
+        hw.fs.save.file.size = data.size();
+        return true;
+
+    case CHEATS:
+        hw.fs.config.joyfile.setCheatsEnabled(a);
+        return true;
+
+    case KEY:
+        hw.input.pressKey(a, b);
+        return true;
+
+    case JOYSTICK_AXES:
+        hw.input.setJoystickAxes(x, y);
+        return true;
+
+    case JOYSTICK_BUTTON:
+        hw.input.setJoystickButton(a);
+        return true;
+
+    case MOUSE_TRACKING:
+        hw.input.setMouseTracking(a, b);
+        return true;
+
+    case MOUSE_BUTTON:
+        hw.input.setMouseButton(a);
+        return true;
+
+    case END_MOUSE_TRACKING:
+        hw.input.endMouseTracking();
+        return true;
+
+    case END:
+        return true;
+    }
+    assert(0);
+    return false;
+}
+
+static MovieTimestamp timestampNow(Hardware &hw, uint32_t step,
+                                   uint32_t frame_base) {
+    MovieTimestamp when;
+    when.step = step;
+    when.frame = hw.output.getEmulatedFrameCount() - frame_base;
+    when.clock = hw.process ? hw.process->getClock() : 0;
+    return when;
+}
+
+MovieRecorder::MovieRecorder()
+    : recording(false), anchored(false), position(0), frame_base(0), last() {}
+
+void MovieRecorder::start() {
+    recording = true;
+    anchored = false;
+    bytes.clear();
+}
+
+void MovieRecorder::stop(Hardware &hw) {
+    if (recording && anchored) {
+        write(InputEvent(InputEvent::END),
+              timestampNow(hw, position, frame_base));
+    }
+    recording = false;
+    anchored = false;
+}
+
+bool MovieRecorder::apply(Hardware &hw, const InputEvent &event) {
+    if (!recording || (!anchored && !event.isAnchor())) {
+        return event.apply(hw);
+    }
+
+    if (!anchored) {
+        // Header, with everything an anchor doesn't reset
+        bytes.clear();
+        putBytes(bytes, movie_magic, sizeof movie_magic);
+        bytes.push_back(movie_version);
+        putVarint(bytes, sizeof hw.fs.config.joyfile);
+        putBytes(bytes, &hw.fs.config.joyfile, sizeof hw.fs.config.joyfile);
+        putVarint(bytes, hw.fs.save.file.size);
+        putBytes(bytes, hw.fs.save.buffer, hw.fs.save.file.size);
+
+        anchored = true;
+        position = 0;
+        last = MovieTimestamp();
+        frame_base = hw.output.getEmulatedFrameCount();
+    }
+
+    MovieTimestamp when = timestampNow(hw, position, frame_base);
+    bool result = event.apply(hw);
+
+    InputEvent recorded = event;
+    if (event.type == InputEvent::LOAD_GAME) {
+        recorded.a = result;
+    }
+    write(recorded, when);
+
+    if (event.isAnchor() && result) {
+        position = 0;
+        frame_base = hw.output.getEmulatedFrameCount();
+        last.step = 0;
+        last.frame = 0;
+    }
+    return result;
+}
+
+void MovieRecorder::write(const InputEvent &event, const MovieTimestamp &when) {
+    bytes.push_back(event.type);
+    putVarint(bytes, when.step - last.step);
+    putVarint(bytes, when.frame - last.frame);
+    putVarint(bytes, when.clock - last.clock);
+    last = when;
+
+    switch (event.type) {
+    case InputEvent::EXEC:
+        putString(bytes, event.program);
+        putString(bytes, event.args);
+        break;
+
+    case InputEvent::SAVE_FILE:
+        putVarint(bytes, event.data.size());
+        putBytes(bytes, event.data.data(), event.data.size());
+        break;
+
+    case InputEvent::KEY:
+        bytes.push_back(event.a);
+        bytes.push_back(event.b);
+        break;
+
+    case InputEvent::JOYSTICK_AXES:
+        putBytes(bytes, &event.x, sizeof event.x);
+        putBytes(bytes, &event.y, sizeof event.y);
+        break;
+
+    case InputEvent::MOUSE_TRACKING:
+        putSigned(bytes, event.a);
+        putSigned(bytes, event.b);
+        break;
+
+    case InputEvent::LOAD_GAME:
+    case InputEvent::LOAD_CHIP:
+    case InputEvent::SAVE_GAME:
+    case InputEvent::CHEATS:
+    case InputEvent::JOYSTICK_BUTTON:
+    case InputEvent::MOUSE_BUTTON:
+        bytes.push_back(event.a);
+        break;
+
+    case InputEvent::END_MOUSE_TRACKING:
+    case InputEvent::END:
+        break;
+    }
+}
+
+MoviePlayer::MoviePlayer()
+    : next(0), position(0), frame_base(0), total_steps(0),
+      step_limit(UINT32_MAX), desync_event(-1) {}
+
+bool MoviePlayer::load(const uint8_t *data, size_t size) {
+    MovieReader in(data, size);
+    uint8_t magic[sizeof movie_magic];
+    in.bytes(magic, sizeof magic);
+    if (!in.ok || memcmp(magic, movie_magic, sizeof magic) ||
+        in.byte() != movie_version) {
+        return false;
+    }
+
+    joyfile.resize(in.varint());
+    in.bytes(joyfile.data(), joyfile.size());
+    save_file.resize(std::min<uint32_t>(in.varint(), size));
+    in.bytes(save_file.data(), save_file.size());
+
+    events.clear();
+    MovieTimestamp last = MovieTimestamp();
+    while (in.ok && !in.done()) {
+        TimedEvent te;
+        InputEvent &event = te.event;
+        event.type = InputEvent::Type(in.byte());
+        te.when.step = last.step + in.varint();
+        te.when.frame = last.frame + in.varint();
+        te.when.clock = last.clock + in.varint();
+        last = te.when;
+
+        switch (event.type) {
+        case InputEvent::EXEC:
+            event.program = in.string();
+            event.args = in.string();
+            break;
+
+        case InputEvent::SAVE_FILE:
+            event.data.resize(std::min<uint32_t>(in.varint(), size));
+            in.bytes(event.data.data(), event.data.size());
+            break;
+
+        case InputEvent::KEY:
+            event.a = in.byte();
+            event.b = in.byte();
+            break;
+
+        case InputEvent::JOYSTICK_AXES:
+            in.bytes(&event.x, sizeof event.x);
+            in.bytes(&event.y, sizeof event.y);
+            break;
+
+        case InputEvent::MOUSE_TRACKING:
+            event.a = in.svarint();
+            event.b = in.svarint();
+            break;
+
+        case InputEvent::LOAD_GAME:
+        case InputEvent::LOAD_CHIP:
+        case InputEvent::SAVE_GAME:
+        case InputEvent::CHEATS:
+        case InputEvent::JOYSTICK_BUTTON:
+        case InputEvent::MOUSE_BUTTON:
+            event.a = in.byte();
+            break;
+
+        case InputEvent::END_MOUSE_TRACKING:
+        case InputEvent::END:
+            break;
+
+        default:
+            return false;
+        }
+
+        if (event.type == InputEvent::EXEC ||
+            (event.type == InputEvent::LOAD_GAME && event.a)) {
+            last.step = 0;
+            last.frame = 0;
+        }
+        events.push_back(te);
+    }
+    return in.ok;
+}
+
+void MoviePlayer::start(Hardware &hw) {
+    if (joyfile.size() == sizeof hw.fs.config.joyfile) {
+        memcpy(&hw.fs.config.joyfile, joyfile.data(), joyfile.size());
+    }
+    if (save_file.size() <= sizeof hw.fs.save.buffer) {
+        memcpy(hw.fs.save.buffer, save_file.data(), save_file.size());
+        hw.fs.save.file.size = save_file.size();
+    }
+
+    next = 0;
+    position = 0;
+    frame_base = hw.output.getEmulatedFrameCount();
+    total_steps = 0;
+    desync_event = -1;
+}
+
+MoviePlayer::Cursor MoviePlayer::getCursor() const {
+    Cursor cursor = {next, position, frame_base, total_steps};
+    return cursor;
+}
+
+void MoviePlayer::seek(const Cursor &cursor) {
+    next = cursor.next;
+    position = cursor.position;
+    frame_base = cursor.frame_base;
+    total_steps = cursor.total_steps;
+    desync_event = -1;
+}
+
+bool MoviePlayer::step(Hardware &hw) {
+    if (total_steps >= step_limit) {
+        return false;
+    }
+    while (next < events.size() && events[next].when.step == position) {
+        const TimedEvent &te = events[next];
+        MovieTimestamp now = timestampNow(hw, position, frame_base);
+        if (desync_event < 0 &&
+            (now.frame != te.when.frame || now.clock != te.when.clock)) {
+            desync_event = next;
+        }
+
+        if (te.event.type == InputEvent::END) {
+            next = events.size();
+            return false;
+        }
+
+        bool result = te.event.apply(hw);
+        if (desync_event < 0 && te.event.type == InputEvent::LOAD_GAME &&
+            result != bool(te.event.a)) {
+            desync_event = next;
+        }
+        if (te.event.isAnchor() && result) {
+            position = 0;
+            frame_base = hw.output.getEmulatedFrameCount();
+        }
+        next++;
+    }
+
+    if (isFinished()) {
+        return false;
+    }
+    if (!hw.process) {
+        // The process exited, but the recording kept running it
+        if (desync_event < 0) {
+            desync_event = next;
+        }
+        return false;
+    }
+
+    hw.process->run();
+    position++;
+    total_steps++;
+    return true;
+}
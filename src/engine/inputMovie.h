@@ -0,0 +1,143 @@
+#pragma once
+
+#include "hardware.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// One thing the user did to the machine: input, or starting a program.
+// Events are the unit of movie recording, and applying them is the same
+// code path whether they come from the user or from a movie.
+struct InputEvent {
+    enum Type : uint8_t {
+        EXEC = 1,
+        LOAD_GAME,
+        LOAD_CHIP,
+        SAVE_FILE,
+        CHEATS,
+        KEY,
+        JOYSTICK_AXES,
+        JOYSTICK_BUTTON,
+        MOUSE_TRACKING,
+        MOUSE_BUTTON,
+        END_MOUSE_TRACKING,
+        END,
+        SAVE_GAME, // Runs the game's save function, into slot 'a'
+    };
+
+    Type type;
+    int32_t a, b;
+    float x, y;
+    std::string program, args;
+    std::vector<uint8_t> data;
+
+    InputEvent(Type type = END, int32_t a = 0, int32_t b = 0)
+        : type(type), a(a), b(b), x(0.f), y(0.f) {}
+
+    static InputEvent exec(const char *program, const char *args);
+    static InputEvent saveFile(const FileInfo &file);
+    static InputEvent joystickAxes(float x, float y);
+
+    // Returns the result of functions that can fail, true otherwise
+    bool apply(Hardware &hw) const;
+
+    // Starts a fresh process, which movie timestamps are relative to
+    bool isAnchor() const { return type == EXEC || type == LOAD_GAME; }
+};
+
+// Movie position. Steps count process runs since the last anchor, and they
+// alone decide when an event is replayed. Frames emulated since the anchor,
+// shown or not, and the process clock are recorded alongside, to detect
+// replays that diverge.
+struct MovieTimestamp {
+    uint32_t step;
+    uint32_t frame;
+    uint32_t clock;
+};
+
+// Records events into a compact binary movie.
+//
+// The movie starts at the first anchor (exec or game load) after start(),
+// with the configuration and save file as they were just before it. Events
+// before that are applied but not recorded. Save-state loads and rewinding
+// can't be represented, so the engine stops recording on those.
+class MovieRecorder {
+  public:
+    MovieRecorder();
+
+    void start();
+    void stop(Hardware &hw);
+    bool isRecording() const { return recording; }
+
+    // Apply an event, recording it if we're recording
+    bool apply(Hardware &hw, const InputEvent &event);
+
+    // Call after each process run
+    void countStep() { position++; }
+
+    const std::vector<uint8_t> &getBytes() const { return bytes; }
+
+  private:
+    bool recording;
+    bool anchored;
+    uint32_t position;
+    uint32_t frame_base;
+    MovieTimestamp last;
+    std::vector<uint8_t> bytes;
+
+    void write(const InputEvent &event, const MovieTimestamp &when);
+};
+
+// Replays a recorded movie on a Hardware instance, as fast as it will run.
+class MoviePlayer {
+  public:
+    MoviePlayer();
+
+    // Parse a movie, returning false if it's malformed
+    bool load(const uint8_t *data, size_t size);
+
+    // Prepare the configuration and save file, before the first step()
+    void start(Hardware &hw);
+
+    // Apply any events that are due, then run the process once. Returns
+    // false once the movie is over, or if it can't continue.
+    bool step(Hardware &hw);
+
+    // Where the player is in the movie. Saved along with a snapshot of the
+    // machine, this lets a replay resume from the middle.
+    struct Cursor {
+        size_t next;
+        uint32_t position;
+        uint32_t frame_base;
+        uint32_t total_steps;
+    };
+    Cursor getCursor() const;
+    void seek(const Cursor &cursor);
+
+    // Stop before running the process for this step, counting from the start
+    void setStepLimit(uint32_t steps) { step_limit = steps; }
+
+    bool isFinished() const { return next >= events.size(); }
+    unsigned getEventCount() const { return events.size(); }
+    uint32_t getStepCount() const { return total_steps; }
+
+    // Index of the first event whose timestamp didn't match the recording,
+    // or -1 if there's been no divergence so far
+    int getDesyncEvent() const { return desync_event; }
+
+  private:
+    struct TimedEvent {
+        InputEvent event;
+        MovieTimestamp when;
+    };
+
+    std::vector<uint8_t> joyfile;
+    std::vector<uint8_t> save_file;
+    std::vector<TimedEvent> events;
+    size_t next;
+    uint32_t position;
+    uint32_t frame_base;
+    uint32_t total_steps;
+    uint32_t step_limit;
+    int desync_event;
+};
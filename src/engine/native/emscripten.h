@@ -0,0 +1,17 @@
+#pragma once
+
+// Just enough of emscripten.h to build the engine natively, for tools like
+// the save file fuzzer. Javascript callbacks are dropped.
+
+#include <chrono>
+
+static inline void emscriptenNativeDiscard(...) {}
+
+#define EM_ASM(...) ((void)0)
+#define EM_ASM_(code, ...) emscriptenNativeDiscard(0, ##__VA_ARGS__)
+
+static inline double emscripten_get_now() {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
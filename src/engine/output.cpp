@@ -9,22 +9,47 @@
 #include <type_traits>
 
 OutputInterface::OutputInterface(ColorTable &colorTable)
-    : draw(colorTable), frame_counter(0), reference_timestamp(0) {}
+    : draw(colorTable), frame_counter(0), emulated_frames(0),
+      reference_timestamp(0) {}
 
-void OutputInterface::clear() { frame_counter = 0; }
+void OutputInterface::clear() {
+    frame_counter = 0;
+    emulated_frames = 0;
+}
 
 void OutputInterface::pushFrameCGA(uint32_t, SBTStack *, uint8_t *) {
     frame_counter++;
+    emulated_frames++;
 }
 
-void OutputInterface::drawFrameRGB(uint32_t) { frame_counter++; }
+void OutputInterface::drawFrameRGB(uint32_t) {
+    frame_counter++;
+    emulated_frames++;
+}
 
 void OutputInterface::pushDelay(uint32_t, OutputDelayType) {}
 
 void OutputInterface::pushSpeakerTimestamp(uint32_t) {}
 
+void OutputInterface::saveState(OutputState &state) {
+    state.frame_counter = frame_counter;
+    state.emulated_frames = emulated_frames;
+    state.reference_timestamp = reference_timestamp;
+    state.frameskip_counter = 0;
+    state.items.clear();
+    state.frames.clear();
+}
+
+void OutputInterface::restoreState(const OutputState &state) {
+    frame_counter = state.frame_counter;
+    emulated_frames = state.emulated_frames;
+    reference_timestamp = state.reference_timestamp;
+}
+
 OutputQueue::OutputQueue(ColorTable &colorTable)
-    : OutputInterface(colorTable), frameskip_value(0), frameskip_counter(0) {
+    : OutputInterface(colorTable), sound_sink(nullptr), sound_trace(nullptr),
+      frameskip_value(0), frameskip_counter(0) {
+    setAudioRate(DEFAULT_AUDIO_HZ);
     clear();
 }
 
@@ -38,6 +63,63 @@ void OutputQueue::setFrameSkip(uint32_t frameskip) {
     frameskip_value = frameskip;
 }
 
+void OutputQueue::setSpeakerSynthesis(SpeakerSynthesis synthesis) {
+    speaker.setSynthesis(synthesis);
+}
+
+uint32_t OutputQueue::setAudioRate(uint32_t hz) {
+    // Synthesize directly at the device rate when we can, so the browser
+    // doesn't resample each effect again. Unusual rates are clamped, and the
+    // browser takes care of the rest.
+    if (hz < MIN_AUDIO_HZ) {
+        hz = MIN_AUDIO_HZ;
+    } else if (hz > MAX_AUDIO_HZ) {
+        hz = MAX_AUDIO_HZ;
+    }
+    speaker.setRate(hz);
+
+    // Release the old buffer first; there's no memory growth, and the
+    // largest buffer is over a megabyte.
+    const size_t samples = size_t(hz) * AUDIO_BUFFER_SECONDS;
+    if (pcm_samples.size() != samples) {
+        pcm_samples.clear();
+        pcm_samples.shrink_to_fit();
+        pcm_samples.resize(samples);
+    }
+    return hz;
+}
+
+void OutputQueue::setSoundTrace(SoundTrace *trace) {
+    sound_trace = trace;
+    if (trace) {
+        trace->push(SoundTrace::REFERENCE, reference_timestamp);
+    }
+}
+
+void OutputQueue::saveState(OutputState &state) {
+    OutputInterface::saveState(state);
+    state.frameskip_counter = frameskip_counter;
+    for (size_t i = 0; i < items.size(); i++) {
+        state.items.push_back(items[i]);
+    }
+    for (size_t i = 0; i < frames.size(); i++) {
+        state.frames.push_back(frames[i]);
+    }
+}
+
+void OutputQueue::restoreState(const OutputState &state) {
+    OutputInterface::restoreState(state);
+    frameskip_counter = state.frameskip_counter;
+    items.clear();
+    frames.clear();
+    for (const OutputItem &item : state.items) {
+        items.push_back(item);
+    }
+    for (const CGAFramebuffer &frame : state.frames) {
+        frames.push_back(frame);
+    }
+}
+
 void OutputQueue::pushFrameCGA(uint32_t timestamp, SBTStack *stack,
                                uint8_t *framebuffer) {
     if (frames.full() || items.full()) {
@@ -54,10 +136,12 @@ void OutputQueue::pushFrameCGA(uint32_t timestamp, SBTStack *stack,
 
     // CGA frames are copied and queued
     frames.push_back(*(CGAFramebuffer *)framebuffer);
+    emulated_frames++;
 }
 
 void OutputQueue::drawFrameRGB(uint32_t timestamp) {
     pushDelay(timestamp, OUT_DELAY_FLUSH);
+    emulated_frames++;
     renderFrame();
 }
 
@@ -75,6 +159,10 @@ void OutputQueue::renderFrame() {
 }
 
 void OutputQueue::pushDelay(uint32_t timestamp, OutputDelayType delay_type) {
+    if (sound_trace && delay_type == OUT_DELAY_FLUSH) {
+        sound_trace->push(SoundTrace::FLUSH, timestamp);
+    }
+
     const uint32_t elapsed_msec = clocksToMsec(timestamp - reference_timestamp);
     if (!elapsed_msec) {
         return;
@@ -123,6 +211,10 @@ void OutputQueue::pushSpeakerTimestamp(uint32_t timestamp) {
         return;
     }
 
+    if (sound_trace) {
+        sound_trace->push(SoundTrace::SPEAKER, timestamp);
+    }
+
     pushDelay(timestamp, OUT_DELAY_MERGE_WITH_SOUND);
 
     OutputItem item;
@@ -167,141 +259,34 @@ void OutputQueue::dequeueCGAFrame() {
 
 void OutputQueue::renderSoundEffect(uint32_t first_timestamp) {
     // Starting at the indicated timestamp and from the current output
-    // queue position, slurp up all subsequent audio events and generate
-    // a single PCM sound effect.
-
-    // Filter design from notes/sound-filter-design.ipynb
-    constexpr uint32_t padding_samples = AUDIO_HZ / 10;
-    float filter_state[28][2] = {{0}};
-    constexpr float second_order_stages[28][6] = {
-        {0.009053953112749067, -0.018107906225498134, 0.009053953112749067, 1.0,
-         -1.9796374795399938, 0.9798427166181983}, // 0 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9816736138512914,
-         0.9818400241394235}, // 1 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9835061664508131,
-         0.983641081639581}, // 2 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.985155486977734,
-         0.9852648579720966}, // 3 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9866398923976099,
-         0.9867285483734656}, // 4 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9879758696565433,
-         0.9880477287809956}, // 5 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9891782582335584,
-         0.9892364989957404}, // 6 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9902604145578904,
-         0.9903076150206832}, // 7 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9912343600727092,
-         0.9912726110131748}, // 8 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9921109145571194,
-         0.9921419113636548}, // 9 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.992899816163347,
-         0.9929249334576205}, // 10 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9936098294848998,
-         0.9936301817009935}, // 11 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.994248842843328,
-         0.9942653333957537}, // 12 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9948239558648986,
-         0.9948373170469392}, // 13 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9953415583132041,
-         0.9953523836673354}, // 14 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.995807401048457,
-         0.9958161716249172}, // 15 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9962266598981226,
-         0.9962337655524821}, // 16 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9966039931458075,
-         0.9966097498105327}, // 17 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9969435932751376,
-         0.9969482569645431}, // 18 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.997249233542087,
-         0.9972530117072836}, // 19 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9975243098921462,
-         0.9975273706265284}, // 20 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9977718786872791,
-         0.9977743581887931}, // 21 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9979946906612989,
-         0.9979966992811273}, // 22 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9981952214805052,
-         0.9981968486256011}, // 23 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9983756992488464,
-         0.9983770173552453}, // 24 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9985381292629996,
-         0.9985391970158521}, // 25 of 28
-        {1.0, 2.0, 1.0, 1.0, -1.9603951329819316,
-         0.9623976551531928}, // 26 of 28
-        {1.0, -2.0, 1.0, 1.0, -1.9859539013699274,
-         0.986219511050537}, // 27 of 28
-    };
-
-    static_assert(sizeof filter_state / sizeof filter_state[0] ==
-                      sizeof second_order_stages /
-                          sizeof second_order_stages[0],
-                  "filter stages and state array length must match");
-    constexpr size_t num_filter_stages =
-        sizeof filter_state / sizeof filter_state[0];
-
-    constexpr float cpu_clocks_per_sample =
-        float(OutputQueue::CPU_CLOCK_HZ) / float(AUDIO_HZ);
-
-    uint32_t sample_count = 0;
-    uint32_t sample_limit = AUDIO_BUFFER_SAMPLES;
-    uint32_t ref_timestamp = first_timestamp;
-
-    float clocks_until_impulse = 0.f;
-    float impulse = 1.f;
-
-    while (sample_count < sample_limit) {
-        float signal = 0.f;
-
-        clocks_until_impulse -= cpu_clocks_per_sample;
-        if (clocks_until_impulse < 0.f) {
-            // Impulse here, and set up for the next one
-            signal = impulse;
-            impulse = -impulse;
-
-            if (items.empty() || items.front().otype != OUT_SPEAKER_TIMESTAMP) {
-                // No more timestamps; apply the padding and finish.
-                sample_limit =
-                    std::min(sample_limit, sample_count + padding_samples);
-                clocks_until_impulse = float(UINT32_MAX);
-            } else {
-                uint32_t timestamp = items.front().u.timestamp;
-                uint32_t elapsed_time = timestamp - ref_timestamp;
-                ref_timestamp = timestamp;
-                items.pop_front();
-                clocks_until_impulse += float(elapsed_time);
-            }
-        }
+    // queue position, slurp up all subsequent audio events that fit in the
+    // PCM buffer and generate a single sound effect. Any remaining audio
+    // events will start the next effect.
 
-#pragma unroll
-        for (size_t stage = 0; stage < num_filter_stages; stage++) {
-            // IIR filter implemented as second-order stages
-            const float B0 = second_order_stages[stage][0];
-            const float B1 = second_order_stages[stage][1];
-            const float B2 = second_order_stages[stage][2];
-            const float A0 = second_order_stages[stage][3];
-            const float A1 = second_order_stages[stage][4];
-            const float A2 = second_order_stages[stage][5];
-            assert(A0 == 1.f); // wants to be static_assert but the loop
-                               // isn't constexpr
-
-            float &s1 = filter_state[stage][0];
-            float &s2 = filter_state[stage][1];
-
-            const float x = signal;
-            const float y = B0 * x + s1;
-            s1 = s2 + B1 * x - A1 * y;
-            s2 = B2 * x - A2 * y;
-            signal = y;
-        }
+    const uint32_t max_clocks = AUDIO_BUFFER_SECONDS * CPU_CLOCK_HZ;
+    uint32_t count = 0;
 
-        pcm_samples[sample_count++] = signal;
+    speaker_timestamps[count++] = first_timestamp;
+    while (!items.empty() && items.front().otype == OUT_SPEAKER_TIMESTAMP &&
+           items.front().u.timestamp - first_timestamp < max_clocks) {
+        speaker_timestamps[count++] = items.front().u.timestamp;
+        items.pop_front();
+    }
+
+    uint32_t sample_count = speaker.render(
+        speaker_timestamps, count, &pcm_samples[0], pcm_samples.size());
+
+    if (sound_sink) {
+        sound_sink->renderSound(&pcm_samples[0], sample_count,
+                                speaker.getRate());
+        return;
     }
 
     // Synchronously copy out the buffer and queue it for rendering, in
     // Javascript.
     EM_ASM_(
         { Module.onRenderSound(HEAPF32.subarray($0 / 4, $0 / 4 + $1), $2); },
-        pcm_samples, sample_count, AUDIO_HZ);
+        &pcm_samples[0], sample_count, speaker.getRate());
 }
 
 uint32_t OutputQueue::run() {
@@ -2,6 +2,8 @@
 
 #include "draw.h"
 #include "sbt86.h"
+#include "soundTrace.h"
+#include "speaker.h"
 #include <circular_buffer.hpp>
 #include <list>
 #include <vector>
@@ -25,6 +27,17 @@ struct OutputItem {
     } u;
 };
 
+// Output state for save-states, aside from the RGB backbuffer. Pending items
+// and frames are copied, so a restored machine plays back the same output.
+struct OutputState {
+    uint32_t frame_counter;
+    uint32_t emulated_frames;
+    uint32_t reference_timestamp;
+    uint32_t frameskip_counter;
+    std::vector<OutputItem> items;
+    std::vector<CGAFramebuffer> frames;
+};
+
 class OutputInterface {
   public:
     static const uint32_t CPU_CLOCK_KHZ = 4770;
@@ -44,19 +57,29 @@ class OutputInterface {
         reference_timestamp = timestamp;
     }
 
+    // Frames presented. OutputQueue skips some with frameskip, and counts
+    // queued CGA frames only once they're shown.
     uint32_t getFrameCount() { return frame_counter; }
 
+    // Frames the game produced, counted as they're pushed whether or not
+    // they're ever shown. Movies are timed with this, so they play back the
+    // same on every kind of output.
+    uint32_t getEmulatedFrameCount() { return emulated_frames; }
+
     virtual void clear();
     virtual void pushFrameCGA(uint32_t timestamp, SBTStack *stack,
                               uint8_t *framebuffer);
     virtual void drawFrameRGB(uint32_t timestamp);
     virtual void pushDelay(uint32_t timestamp, OutputDelayType delayType);
     virtual void pushSpeakerTimestamp(uint32_t timestamp);
+    virtual void saveState(OutputState &state);
+    virtual void restoreState(const OutputState &state);
 
     RGBDraw draw;
 
   protected:
     uint32_t frame_counter;
+    uint32_t emulated_frames;
     uint32_t reference_timestamp;
 };
 
@@ -65,6 +88,17 @@ class OutputQueue final : public OutputInterface {
     OutputQueue(ColorTable &colorTable);
 
     void setFrameSkip(uint32_t frameskip);
+    void setSpeakerSynthesis(SpeakerSynthesis synthesis);
+
+    // Choose the sound effect sample rate, returning the rate actually used
+    uint32_t setAudioRate(uint32_t hz);
+    uint32_t getAudioRate() { return speaker.getRate(); }
+
+    // Send sound effects to a sink instead of Javascript, or nullptr
+    void setSoundSink(SoundSink *sink) { sound_sink = sink; }
+
+    // Record sound-related output events into a trace, or nullptr to stop
+    void setSoundTrace(SoundTrace *trace);
     uint32_t run();
 
     virtual void clear();
@@ -73,13 +107,15 @@ class OutputQueue final : public OutputInterface {
     virtual void drawFrameRGB(uint32_t timestamp);
     virtual void pushDelay(uint32_t timestamp, OutputDelayType delayType);
     virtual void pushSpeakerTimestamp(uint32_t timestamp);
+    virtual void saveState(OutputState &state);
+    virtual void restoreState(const OutputState &state);
 
-    static constexpr uint32_t AUDIO_HZ = 48000;
+    static constexpr uint32_t DEFAULT_AUDIO_HZ = 48000;
+    static constexpr uint32_t MIN_AUDIO_HZ = 22050;
+    static constexpr uint32_t MAX_AUDIO_HZ = 96000;
     static constexpr unsigned AUDIO_BUFFER_SECONDS = 4;
-    static constexpr unsigned AUDIO_BUFFER_SAMPLES =
-        AUDIO_HZ * AUDIO_BUFFER_SECONDS;
 
-    float pcm_samples[AUDIO_BUFFER_SAMPLES];
+    std::vector<float> pcm_samples;
 
     static constexpr unsigned MAX_BUFFERED_FRAMES = 128;
     static constexpr unsigned MAX_BUFFERED_EVENTS = 16384;
@@ -88,6 +124,11 @@ class OutputQueue final : public OutputInterface {
     jm::circular_buffer<OutputItem, MAX_BUFFERED_EVENTS> items;
     jm::circular_buffer<CGAFramebuffer, MAX_BUFFERED_FRAMES> frames;
 
+    SpeakerRenderer speaker;
+    uint32_t speaker_timestamps[MAX_BUFFERED_EVENTS];
+    SoundSink *sound_sink;
+    SoundTrace *sound_trace;
+
     uint32_t frameskip_value;
     uint32_t frameskip_counter;
 
@@ -0,0 +1,204 @@
+#include "puzzleSearch.h"
+#include "stateHash.h"
+#include <algorithm>
+#include <deque>
+#include <math.h>
+#include <queue>
+#include <stdlib.h>
+
+int PuzzleSearch::ReachPosition::distance(ROData &data) {
+    if (data.world->getObjectRoom(RO_OBJ_PLAYER) != room) {
+        return -1;
+    }
+    int px, py;
+    data.world->getObjectXY(RO_OBJ_PLAYER, px, py);
+    return abs(px - x) + abs(py - y);
+}
+
+double PuzzleSearch::ReachPosition::score(ROData &data) {
+    // Any state in the wrong room is still worth exploring from
+    int d = distance(data);
+    return d < 0 ? 0.0 : 1000.0 - d;
+}
+
+bool PuzzleSearch::ReachPosition::isGoal(ROData &data) {
+    int d = distance(data);
+    return d >= 0 && d <= tolerance;
+}
+
+PuzzleSearch::PuzzleSearch(ColorTable &colorTable)
+    : colorTable(colorTable), frames_per_action(4) {}
+
+void PuzzleSearch::addAction(const std::vector<InputEvent> &events) {
+    actions.push_back(events);
+}
+
+void PuzzleSearch::tracePath(unsigned node, std::vector<unsigned> &path) {
+    path.clear();
+    for (; node != 0; node = nodes[node].parent) {
+        path.push_back(nodes[node].action);
+    }
+    std::reverse(path.begin(), path.end());
+}
+
+PuzzleSearch::Result PuzzleSearch::search(Hardware &root,
+                                          Objective &objective,
+                                          Strategy strategy,
+                                          unsigned max_nodes,
+                                          unsigned max_depth,
+                                          unsigned threads) {
+    Result result;
+    result.found = false;
+    result.best_score = -INFINITY;
+    result.expanded = 0;
+    result.unique_states = 0;
+    nodes.clear();
+    seen.clear();
+
+    ROData data;
+    if (!root.process || !data.fromProcess(root.process) || actions.empty()) {
+        return result;
+    }
+
+    // Root node
+    nodes.emplace_back();
+    root.saveSnapshot(nodes[0].snapshot);
+    nodes[0].parent = 0;
+    nodes[0].action = 0;
+    nodes[0].depth = 0;
+    nodes[0].score = objective.score(data);
+    result.best_score = nodes[0].score;
+    seen.insert(stateHash64(root.mem, Hardware::MEM_SIZE));
+    if (objective.isGoal(data)) {
+        result.found = true;
+        result.unique_states = seen.size();
+        return result;
+    }
+
+    // Frontier, one of these depending on strategy
+    std::deque<unsigned> fifo;
+    std::priority_queue<std::pair<double, unsigned>> ranked;
+    auto push = [&](unsigned node) {
+        if (strategy == BEST_FIRST) {
+            ranked.push(std::make_pair(nodes[node].score, node));
+        } else {
+            fifo.push_back(node);
+        }
+    };
+    auto empty = [&]() {
+        return strategy == BEST_FIRST ? ranked.empty() : fifo.empty();
+    };
+    auto pop = [&]() {
+        unsigned node;
+        if (strategy == BEST_FIRST) {
+            node = ranked.top().second;
+            ranked.pop();
+        } else {
+            node = fifo.front();
+            fifo.pop_front();
+        }
+        return node;
+    };
+    push(0);
+
+    // A few more instances than threads, so fast candidates leave work to
+    // steal
+    threads = std::max(1u, std::min(threads, BatchHost::getMaxThreads()));
+    const unsigned num_instances = threads * 2;
+    BatchHost host(colorTable);
+    for (unsigned i = 0; i < num_instances; i++) {
+        host.addInstance("");
+    }
+
+    struct Job {
+        unsigned parent;
+        unsigned action;
+    };
+    std::vector<Job> jobs;
+    std::vector<unsigned> parents;
+
+    while (!empty() && result.expanded < max_nodes) {
+        // Every action from the next few frontier nodes
+        jobs.clear();
+        parents.clear();
+        while (!empty() && jobs.size() < num_instances &&
+               result.expanded + parents.size() < max_nodes) {
+            unsigned parent = pop();
+            parents.push_back(parent);
+            for (unsigned a = 0; a < actions.size(); a++) {
+                Job job = {parent, a};
+                jobs.push_back(job);
+            }
+        }
+
+        for (size_t first = 0; first < jobs.size(); first += num_instances) {
+            const unsigned count =
+                std::min<size_t>(num_instances, jobs.size() - first);
+
+            for (unsigned i = 0; i < num_instances; i++) {
+                Hardware &hw = host.getInstance(i);
+                if (i >= count) {
+                    hw.exec("");
+                    continue;
+                }
+                const Job &job = jobs[first + i];
+                hw.loadSnapshot(nodes[job.parent].snapshot);
+                for (const InputEvent &event : actions[job.action]) {
+                    event.apply(hw);
+                }
+            }
+
+            host.run(frames_per_action, threads);
+
+            for (unsigned i = 0; i < count; i++) {
+                const Job &job = jobs[first + i];
+                Hardware &hw = host.getInstance(i);
+                if (!hw.process || !data.fromProcess(hw.process)) {
+                    continue;
+                }
+                if (!seen.insert(stateHash64(hw.mem, Hardware::MEM_SIZE))
+                         .second) {
+                    continue;
+                }
+
+                double score = objective.score(data);
+                result.best_score = std::max(result.best_score, score);
+                if (score < 0.0) {
+                    continue;
+                }
+
+                const unsigned depth = nodes[job.parent].depth + 1;
+                const bool goal = objective.isGoal(data);
+                if (!goal && depth >= max_depth) {
+                    continue;
+                }
+
+                nodes.emplace_back();
+                Node &child = nodes.back();
+                child.parent = job.parent;
+                child.action = job.action;
+                child.depth = depth;
+                child.score = score;
+
+                if (goal) {
+                    result.found = true;
+                    tracePath(nodes.size() - 1, result.path);
+                    result.expanded += parents.size();
+                    result.unique_states = seen.size();
+                    return result;
+                }
+                hw.saveSnapshot(child.snapshot, &nodes[job.parent].snapshot);
+                push(nodes.size() - 1);
+            }
+        }
+
+        // Expanded nodes only need to remember their place in the tree
+        for (unsigned parent : parents) {
+            nodes[parent].snapshot = HardwareSnapshot();
+        }
+        result.expanded += parents.size();
+    }
+
+    result.unique_states = seen.size();
+    return result;
+}
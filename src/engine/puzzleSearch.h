@@ -0,0 +1,82 @@
+#pragma once
+
+#include "batchHost.h"
+#include "inputMovie.h"
+#include "roData.h"
+#include "snapshot.h"
+#include <stdint.h>
+#include <unordered_set>
+#include <vector>
+
+// Explores puzzle solutions by brute force. Starting from a snapshot of a
+// running game, each search node tries every action: a short list of input
+// events followed by a fixed number of frames. The resulting game state is
+// scored from ROData, deduplicated by a hash of memory, and queued for
+// expansion breadth-first or best-first. Candidates run in parallel waves on
+// BatchHost instances.
+class PuzzleSearch {
+  public:
+    enum Strategy {
+        BREADTH_FIRST,
+        BEST_FIRST,
+    };
+
+    // What we're searching for. Higher scores are better; a negative score
+    // prunes the node.
+    class Objective {
+      public:
+        virtual ~Objective() {}
+        virtual double score(ROData &data) = 0;
+        virtual bool isGoal(ROData &data) = 0;
+    };
+
+    // Built-in objective: walk the player to a room, near a position
+    class ReachPosition : public Objective {
+      public:
+        ReachPosition(RORoomId room, int x, int y, int tolerance)
+            : room(room), x(x), y(y), tolerance(tolerance) {}
+
+        virtual double score(ROData &data);
+        virtual bool isGoal(ROData &data);
+
+      private:
+        RORoomId room;
+        int x, y, tolerance;
+        int distance(ROData &data);
+    };
+
+    struct Result {
+        bool found;
+        std::vector<unsigned> path; // Action indices from the root
+        double best_score;
+        unsigned expanded;
+        unsigned unique_states;
+    };
+
+    PuzzleSearch(ColorTable &colorTable);
+
+    void addAction(const std::vector<InputEvent> &events);
+    unsigned getActionCount() const { return actions.size(); }
+    void setFramesPerAction(unsigned frames) { frames_per_action = frames; }
+
+    Result search(Hardware &root, Objective &objective, Strategy strategy,
+                  unsigned max_nodes, unsigned max_depth, unsigned threads);
+
+  private:
+    struct Node {
+        HardwareSnapshot snapshot; // Released once expanded
+        unsigned parent;
+        unsigned action;
+        unsigned depth;
+        double score;
+    };
+
+    ColorTable &colorTable;
+    std::vector<std::vector<InputEvent>> actions;
+    unsigned frames_per_action;
+
+    std::vector<Node> nodes;
+    std::unordered_set<uint64_t> seen;
+
+    void tracePath(unsigned node, std::vector<unsigned> &path);
+};
@@ -0,0 +1,114 @@
+#include "replayVerify.h"
+#include "stateHash.h"
+#include <algorithm>
+
+static uint64_t digestState(Hardware &hw) {
+    StateHasher hasher;
+    return hasher.push(hw).total;
+}
+
+SegmentedReplay::SegmentedReplay(ColorTable &colorTable)
+    : colorTable(colorTable) {}
+
+bool SegmentedReplay::load(const uint8_t *data, size_t size) {
+    MoviePlayer player;
+    keyframes.clear();
+    if (!player.load(data, size)) {
+        movie.clear();
+        return false;
+    }
+    movie.assign(data, data + size);
+    return true;
+}
+
+void SegmentedReplay::capture(Hardware &hw, const MoviePlayer &player,
+                              uint32_t frame) {
+    keyframes.emplace_back();
+    Keyframe &k = keyframes.back();
+    const Keyframe *previous =
+        keyframes.size() > 1 ? &keyframes[keyframes.size() - 2] : nullptr;
+
+    hw.saveSnapshot(k.snapshot, previous ? &previous->snapshot : nullptr);
+    k.cursor = player.getCursor();
+    k.frame = frame;
+    k.digest = digestState(hw);
+}
+
+unsigned SegmentedReplay::record(unsigned interval_frames) {
+    keyframes.clear();
+    if (movie.empty()) {
+        return 0;
+    }
+
+    BatchHost host(colorTable);
+    MoviePlayer player;
+    player.load(movie.data(), movie.size());
+    host.addInstance("");
+    host.setMovie(0, &player);
+    Hardware &hw = host.getInstance(0);
+
+    capture(hw, player, 0);
+    while (!player.isFinished()) {
+        const uint32_t steps = player.getStepCount();
+        host.run(interval_frames, 1);
+        if (player.getStepCount() == steps) {
+            // Finished without running, or stalled on a desync
+            break;
+        }
+        capture(hw, player, host.getTotalFrames());
+    }
+    return keyframes.size();
+}
+
+SegmentedReplay::Result SegmentedReplay::verify(unsigned threads) {
+    Result result = {0, -1, 0};
+    if (keyframes.size() < 2) {
+        return result;
+    }
+    result.segments = keyframes.size() - 1;
+
+    // Segments run in waves, with a few more instances than threads so
+    // workers that finish early have something to steal.
+    threads = std::max(1u, std::min(threads, BatchHost::getMaxThreads()));
+    const unsigned wave_size = std::min(result.segments, threads * 2);
+    BatchHost host(colorTable);
+    for (unsigned i = 0; i < wave_size; i++) {
+        host.addInstance("");
+    }
+    std::vector<MoviePlayer> players(wave_size);
+
+    for (unsigned first = 0; first < result.segments; first += wave_size) {
+        const unsigned count = std::min(wave_size, result.segments - first);
+
+        for (unsigned i = 0; i < count; i++) {
+            const Keyframe &start = keyframes[first + i];
+            const Keyframe &end = keyframes[first + i + 1];
+            MoviePlayer &player = players[i];
+            player.load(movie.data(), movie.size());
+
+            // The player's own setup runs first, then the snapshot replaces
+            // everything it touched.
+            host.setMovie(i, &player);
+            host.getInstance(i).loadSnapshot(start.snapshot);
+            player.seek(start.cursor);
+            player.setStepLimit(end.cursor.total_steps);
+        }
+        for (unsigned i = count; i < wave_size; i++) {
+            host.setMovie(i, nullptr);
+            host.getInstance(i).exec("");
+        }
+
+        host.run(UINT32_MAX, threads);
+
+        for (unsigned i = 0; i < count; i++) {
+            const Keyframe &end = keyframes[first + i + 1];
+            if (players[i].getStepCount() != end.cursor.total_steps ||
+                digestState(host.getInstance(i)) != end.digest) {
+                result.first_failed = first + i;
+                result.first_failed_frame = keyframes[first + i].frame;
+                return result;
+            }
+        }
+    }
+    return result;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "batchHost.h"
+#include "inputMovie.h"
+#include "snapshot.h"
+#include <stdint.h>
+#include <vector>
+
+// Checks that a movie replays deterministically, using every core.
+//
+// A serial reference replay captures a keyframe every few hundred frames: a
+// machine snapshot, the movie cursor, and a state digest. Verification then
+// replays the segments between keyframes concurrently, each on an instance
+// restored from the keyframe at its start, and checks that each ends with
+// the digest of the keyframe at its end.
+class SegmentedReplay {
+  public:
+    SegmentedReplay(ColorTable &colorTable);
+
+    // Parse a movie, returning false if it's malformed
+    bool load(const uint8_t *data, size_t size);
+
+    // Serial reference replay, returning the number of keyframes captured.
+    // Keyframes share unchanged pages with each other.
+    unsigned record(unsigned interval_frames);
+
+    struct Result {
+        unsigned segments;
+        int first_failed;
+        uint32_t first_failed_frame;
+    };
+
+    // Replay every segment on up to 'threads' workers at once
+    Result verify(unsigned threads);
+
+  private:
+    struct Keyframe {
+        HardwareSnapshot snapshot;
+        MoviePlayer::Cursor cursor;
+        uint32_t frame;
+        uint64_t digest;
+    };
+
+    ColorTable &colorTable;
+    std::vector<uint8_t> movie;
+    std::vector<Keyframe> keyframes;
+
+    void capture(Hardware &hw, const MoviePlayer &player, uint32_t frame);
+};
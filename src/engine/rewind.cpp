@@ -0,0 +1,249 @@
+#include "rewind.h"
+#include <algorithm>
+#include <string.h>
+
+// Memory regions in a snapshot, in the order of global page indices
+static PageSnapshot HardwareSnapshot::*const regions[] = {
+    &HardwareSnapshot::mem,
+    &HardwareSnapshot::backbuffer,
+    &HardwareSnapshot::save_buffer,
+    &HardwareSnapshot::autosave_buffer,
+};
+static const unsigned num_regions = sizeof regions / sizeof regions[0];
+static const unsigned PAGE_SIZE = PageSnapshot::PAGE_SIZE;
+
+static PageSnapshot &findPage(HardwareSnapshot &snapshot, unsigned global,
+                              size_t &index) {
+    for (unsigned r = 0; r < num_regions; r++) {
+        PageSnapshot &region = snapshot.*regions[r];
+        if (global < region.getPageCount()) {
+            index = global;
+            return region;
+        }
+        global -= region.getPageCount();
+    }
+    assert(0 && "Page index out of range");
+    index = 0;
+    return snapshot.mem;
+}
+
+RewindBuffer::RewindBuffer()
+    : budget(0), usage(0), frames_until_keyframe(0), cctx(nullptr),
+      dctx(nullptr) {}
+
+RewindBuffer::~RewindBuffer() {
+    ZSTD_freeCCtx(cctx);
+    ZSTD_freeDCtx(dctx);
+}
+
+size_t RewindBuffer::Entry::bytes() const {
+    return sizeof *this +
+           state.output.items.capacity() * sizeof state.output.items[0] +
+           state.output.frames.capacity() * sizeof state.output.frames[0] +
+           state.process_state.locals.capacity() +
+           delta_pages.capacity() * sizeof delta_pages[0] + delta.capacity() +
+           keyframe.capacity();
+}
+
+void RewindBuffer::setBudget(size_t bytes) {
+    budget = bytes;
+    if (budget) {
+        trimToBudget();
+    } else {
+        clear();
+    }
+}
+
+void RewindBuffer::clear() {
+    entries.clear();
+    head = HardwareSnapshot();
+    usage = 0;
+    frames_until_keyframe = 0;
+}
+
+void RewindBuffer::compress(std::vector<uint8_t> &dest) {
+    // Contexts are only created once rewinding is actually enabled. Speed
+    // matters much more than ratio here. The deltas are mostly zeroes, and
+    // even the fastest level squeezes those well.
+    if (!cctx) {
+        cctx = ZSTD_createCCtx();
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, 1);
+    }
+    dest.resize(ZSTD_compressBound(scratch.size()));
+    size_t result = ZSTD_compress2(cctx, dest.data(), dest.size(),
+                                   scratch.data(), scratch.size());
+    assert(!ZSTD_isError(result));
+    dest.resize(result);
+    dest.shrink_to_fit();
+}
+
+void RewindBuffer::decompress(const std::vector<uint8_t> &src, size_t size) {
+    if (!dctx) {
+        dctx = ZSTD_createDCtx();
+    }
+    scratch.resize(size);
+    size_t result = ZSTD_decompressDCtx(dctx, scratch.data(), scratch.size(),
+                                        src.data(), src.size());
+    assert(result == size);
+    (void)result;
+}
+
+void RewindBuffer::push(Hardware &hw) {
+    if (!budget) {
+        return;
+    }
+
+    HardwareSnapshot next;
+    hw.saveSnapshot(next, entries.empty() ? nullptr : &head);
+
+    if (!entries.empty()) {
+        // The previous frame gets a delta to this one. Capture already
+        // shared every unchanged page, so only compare pointers.
+        Entry &prev = entries.back();
+        usage -= prev.bytes();
+        prev.delta_pages.clear();
+        scratch.clear();
+
+        unsigned global = 0;
+        for (unsigned r = 0; r < num_regions; r++) {
+            const PageSnapshot &before = head.*regions[r];
+            const PageSnapshot &after = next.*regions[r];
+            for (size_t i = 0; i < after.getPageCount(); i++, global++) {
+                const PageSnapshot::Page *a = before.getPage(i).get();
+                const PageSnapshot::Page *b = after.getPage(i).get();
+                if (a != b) {
+                    size_t offset = scratch.size();
+                    scratch.resize(offset + PAGE_SIZE);
+                    for (unsigned k = 0; k < PAGE_SIZE; k++) {
+                        scratch[offset + k] = a->bytes[k] ^ b->bytes[k];
+                    }
+                    prev.delta_pages.push_back(global);
+                }
+            }
+        }
+
+        if (prev.delta_pages.empty()) {
+            prev.delta.clear();
+        } else {
+            compress(prev.delta);
+        }
+        prev.delta_pages.shrink_to_fit();
+        usage += prev.bytes();
+    }
+
+    Entry entry;
+    entry.state = next.state;
+
+    if (frames_until_keyframe == 0) {
+        scratch.clear();
+        for (unsigned r = 0; r < num_regions; r++) {
+            const PageSnapshot &region = next.*regions[r];
+            for (size_t i = 0; i < region.getPageCount(); i++) {
+                const uint8_t *bytes = region.getPage(i)->bytes;
+                scratch.insert(scratch.end(), bytes, bytes + PAGE_SIZE);
+            }
+        }
+        compress(entry.keyframe);
+        frames_until_keyframe = KEYFRAME_INTERVAL;
+    }
+    frames_until_keyframe--;
+
+    head = std::move(next);
+    usage += entry.bytes();
+    entries.push_back(std::move(entry));
+    trimToBudget();
+}
+
+void RewindBuffer::trimToBudget() {
+    // Deltas chain backward from the newest frame, so the oldest frames can
+    // always be dropped.
+    while (usage > budget && entries.size() > 1) {
+        usage -= entries.front().bytes();
+        entries.pop_front();
+    }
+}
+
+void RewindBuffer::applyDelta(const Entry &entry) {
+    if (entry.delta_pages.empty()) {
+        return;
+    }
+    decompress(entry.delta, entry.delta_pages.size() * PAGE_SIZE);
+
+    for (size_t j = 0; j < entry.delta_pages.size(); j++) {
+        size_t index;
+        PageSnapshot &region = findPage(head, entry.delta_pages[j], index);
+        const PageSnapshot::Page &old_page = *region.getPage(index);
+        const uint8_t *delta = &scratch[j * PAGE_SIZE];
+
+        std::shared_ptr<PageSnapshot::Page> page(new PageSnapshot::Page);
+        for (unsigned k = 0; k < PAGE_SIZE; k++) {
+            page->bytes[k] = old_page.bytes[k] ^ delta[k];
+        }
+        region.setPage(index, page);
+    }
+}
+
+void RewindBuffer::loadKeyframe(const Entry &entry) {
+    size_t total_pages = 0;
+    for (unsigned r = 0; r < num_regions; r++) {
+        total_pages += (head.*regions[r]).getPageCount();
+    }
+    decompress(entry.keyframe, total_pages * PAGE_SIZE);
+
+    const uint8_t *bytes = scratch.data();
+    for (unsigned r = 0; r < num_regions; r++) {
+        PageSnapshot &region = head.*regions[r];
+        for (size_t i = 0; i < region.getPageCount(); i++) {
+            std::shared_ptr<PageSnapshot::Page> page(new PageSnapshot::Page);
+            memcpy(page->bytes, bytes, PAGE_SIZE);
+            region.setPage(i, page);
+            bytes += PAGE_SIZE;
+        }
+    }
+}
+
+unsigned RewindBuffer::stepBack(Hardware &hw, unsigned frames) {
+    if (entries.empty()) {
+        return 0;
+    }
+    frames = std::min<size_t>(frames, entries.size() - 1);
+    const size_t target = entries.size() - 1 - frames;
+
+    // Walking back from the newest frame costs one delta per frame. Start
+    // from a keyframe instead if one is closer.
+    size_t keyframe = target + 1;
+    for (size_t i = target + 1; i-- > 0 && target - i < KEYFRAME_INTERVAL;) {
+        if (!entries[i].keyframe.empty()) {
+            keyframe = i;
+            break;
+        }
+    }
+
+    if (keyframe <= target && target - keyframe + 1 < frames) {
+        loadKeyframe(entries[keyframe]);
+        for (size_t i = keyframe; i < target; i++) {
+            applyDelta(entries[i]);
+        }
+    } else {
+        for (size_t i = entries.size() - 1; i > target; i--) {
+            applyDelta(entries[i - 1]);
+        }
+    }
+
+    // The target is now the newest frame
+    while (entries.size() > target + 1) {
+        usage -= entries.back().bytes();
+        entries.pop_back();
+    }
+    Entry &newest = entries.back();
+    usage -= newest.bytes();
+    newest.delta_pages.clear();
+    newest.delta_pages.shrink_to_fit();
+    newest.delta.clear();
+    newest.delta.shrink_to_fit();
+    usage += newest.bytes();
+
+    head.state = newest.state;
+    hw.loadSnapshot(head);
+    return frames;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "hardware.h"
+#include "snapshot.h"
+#include <deque>
+#include <stdint.h>
+#include <vector>
+#include <zstd.h>
+
+// Bounded history of machine states, one per frame, for rewinding.
+//
+// The newest state is kept as a full HardwareSnapshot. Every older frame
+// keeps its small HardwareState, plus the pages that changed between it and
+// the following frame, XORed together and compressed. XOR deltas work in
+// both directions, so stepping back one frame applies one delta to the newest
+// state, and old frames can be dropped from the front at any time.
+//
+// Keyframes, with every page compressed, are kept at intervals so that long
+// jumps cost at most KEYFRAME_INTERVAL deltas.
+class RewindBuffer {
+  public:
+    RewindBuffer();
+    ~RewindBuffer();
+
+    static constexpr unsigned KEYFRAME_INTERVAL = 64;
+
+    // Memory budget for history in bytes, not counting the newest state.
+    // Zero disables capture.
+    void setBudget(size_t bytes);
+    size_t getBudget() const { return budget; }
+
+    void clear();
+
+    // Capture the machine as the newest frame. Call between process runs.
+    void push(Hardware &hw);
+
+    // Restore the state from 'frames' pushes ago, discarding newer frames.
+    // Returns the number of frames actually stepped back.
+    unsigned stepBack(Hardware &hw, unsigned frames);
+
+    unsigned getFrameCount() const { return entries.size(); }
+    size_t getMemoryUsage() const { return usage; }
+
+  private:
+    struct Entry {
+        HardwareState state;
+
+        // Global page indices that differ between this frame and the next,
+        // and the compressed XOR of those pages in the same order.
+        std::vector<uint16_t> delta_pages;
+        std::vector<uint8_t> delta;
+
+        // Every page, compressed, on keyframes only
+        std::vector<uint8_t> keyframe;
+
+        size_t bytes() const;
+    };
+
+    std::deque<Entry> entries;
+    HardwareSnapshot head;
+    size_t budget;
+    size_t usage;
+    unsigned frames_until_keyframe;
+
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+    std::vector<uint8_t> scratch;
+
+    void compress(std::vector<uint8_t> &dest);
+    void decompress(const std::vector<uint8_t> &src, size_t size);
+    void applyDelta(const Entry &entry);
+    void loadKeyframe(const Entry &entry);
+    void trimToBudget();
+};
@@ -134,7 +134,7 @@ RORobotGrabber *RORobotGrabber::fromProcess(SBTProcess *proc) {
                           proc->memSeg(proc->reg.ds) + addr);
 }
 
-const char *ROSavedGame::getWorldName() {
+const char *ROSavedGame::getWorldName(uint8_t worldId) {
     switch (worldId) {
     case RO_WORLD_SEWER:
         return "City Sewer";
@@ -170,6 +170,44 @@ const char *ROSavedGame::getProcessName() {
     return 0;
 }
 
+void ROSavedGame::getInfo(ROSaveInfo &info) {
+    static const struct {
+        RORobotId id;
+        ROObjectId obj;
+    } robots[] = {
+        {RO_ROBOT_SPARKY, RO_OBJ_ROBOT_SPARKY_L},
+        {RO_ROBOT_CHECKERS, RO_OBJ_ROBOT_CHECKERS_L},
+        {RO_ROBOT_SCANNER, RO_OBJ_ROBOT_SCANNER_L},
+        {RO_ROBOT_MC, RO_OBJ_ROBOT_MC_L},
+    };
+
+    info.worldId = worldId;
+    info.worldName = getWorldName();
+    info.playerRoom = world.getObjectRoom(RO_OBJ_PLAYER);
+    int x, y;
+    world.getObjectXY(RO_OBJ_PLAYER, x, y);
+    info.playerX = x;
+    info.playerY = y;
+
+    // The MC robot's object ID means something else outside the game. Any
+    // robot that isn't in a room isn't in this world.
+    const char *process = getProcessName();
+    const bool game = process && !strcmp(process, "game.exe");
+    info.robotCount = 0;
+    for (unsigned i = 0; i < sizeof robots / sizeof robots[0]; i++) {
+        RORoomId room = world.getObjectRoom(robots[i].obj);
+        if (room == RO_ROOM_NONE || (robots[i].id == RO_ROBOT_MC && !game)) {
+            continue;
+        }
+        world.getObjectXY(robots[i].obj, x, y);
+        info.robots[info.robotCount].id = robots[i].id;
+        info.robots[info.robotCount].room = room;
+        info.robots[info.robotCount].x = x;
+        info.robots[info.robotCount].y = y;
+        info.robotCount++;
+    }
+}
+
 bool ROData::fromProcess(SBTProcess *proc) {
     world = ROWorld::fromProcess(proc);
     circuit = ROCircuit::fromProcess(proc);
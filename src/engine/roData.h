@@ -742,6 +742,28 @@ struct ROChipPins {
     uint8_t pins[8];
 };
 
+/*
+ * A summary of a saved game, read straight from the file without running
+ * anything. Battery levels live in process memory rather than in the save
+ * file, so robots only report where they are.
+ */
+struct ROSaveInfo {
+    uint8_t worldId;
+    const char *worldName;
+
+    RORoomId playerRoom;
+    uint8_t playerX;
+    uint8_t playerY;
+
+    unsigned robotCount;
+    struct {
+        RORobotId id;
+        RORoomId room;
+        uint8_t x;
+        uint8_t y;
+    } robots[4];
+};
+
 /*
  * The on-disk file format for a saved game. These are the .GSV/.LSV
  * files saved by GAME.EXE or LAB.EXE. There doesn't seem to be any
@@ -768,8 +790,11 @@ class ROSavedGame {
     uint8_t unk_offset_y;
     uint8_t worldId;
 
-    const char *getWorldName();
+    const char *getWorldName() { return getWorldName(worldId); }
     const char *getProcessName();
+    void getInfo(ROSaveInfo &info);
+
+    static const char *getWorldName(uint8_t worldId);
 };
 
 /*
@@ -29,6 +29,7 @@ void SBTProcess::exec(const char *cmdLine) {
     // Decompress nonzero data
     ZSTD_decompress(data_segment, end_of_mem - data_segment, getData(),
                     getDataLen());
+    hardware->markDirty(0, Hardware::MEM_SIZE);
 
     /*
      * Program Segment Prefix. Locate it just before the beginning of
@@ -106,6 +107,22 @@ void SBTProcess::continueFrom(SBTRegs regs, continue_func_t fn,
     longjmp(jmp_yield, 1);
 }
 
+void SBTProcess::saveState(SBTProcessState &state) {
+    state.reg = reg;
+    state.default_reg = default_reg;
+    state.continue_func = continue_func;
+    state.default_func = default_func;
+    saveLocals(state.locals);
+}
+
+void SBTProcess::restoreState(const SBTProcessState &state) {
+    reg = state.reg;
+    default_reg = state.default_reg;
+    continue_func = state.continue_func;
+    default_func = state.default_func;
+    restoreLocals(state.locals);
+}
+
 void SBTProcess::failedDynamicBranch(uint16_t cs, uint16_t ip, uint32_t value) {
     fprintf(stderr, "SBT86, failed dynamic branch at %04x:%04x, to %x\n", cs,
             ip, value);
@@ -141,7 +158,7 @@ uint8_t SBTProcess::peek8(uint16_t seg, uint16_t off) {
 }
 
 void SBTProcess::poke8(uint16_t seg, uint16_t off, uint8_t value) {
-    memSeg(seg)[off] = value;
+    *hardware->markDirty(memSeg(seg) + off) = value;
 }
 
 uint16_t SBTProcess::peek16(uint16_t seg, uint16_t off) {
@@ -149,7 +166,7 @@ uint16_t SBTProcess::peek16(uint16_t seg, uint16_t off) {
 }
 
 void SBTProcess::poke16(uint16_t seg, uint16_t off, uint16_t value) {
-    write16(memSeg(seg) + off, value);
+    write16(hardware->markDirty16(memSeg(seg) + off), value);
 }
 
 SBTStack::SBTStack() { reset(); }
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <setjmp.h>
 #include <stdint.h>
+#include <vector>
 
 #define SBT_INLINE inline __attribute__((always_inline))
 
@@ -14,6 +15,7 @@ class Hardware;
 class SBTRegs;
 class SBTStack;
 class SBTProcess;
+class SBTProcessState;
 class SBTSegmentCache;
 
 /*
@@ -259,9 +261,21 @@ class SBTProcess {
 
     void failedDynamicBranch(uint16_t cs, uint16_t ip, uint32_t value);
 
+    /*
+     * Capture or restore everything needed to resume this process,
+     * aside from emulated memory. Only valid between calls to run().
+     */
+    void saveState(SBTProcessState &state);
+    void restoreState(const SBTProcessState &state);
+
     virtual int getAddress(SBTAddressId id) = 0;
     virtual const char *getFilename() = 0;
 
+    /*
+     * Emulated CPU clock, as of the last time run() returned.
+     */
+    virtual uint32_t getClock() = 0;
+
     SBTRegs reg;
 
   private:
@@ -270,6 +284,8 @@ class SBTProcess {
      */
     virtual void loadEnvironment(SBTStack *stack, SBTRegs reg) = 0;
     virtual void flushOutput() = 0;
+    virtual void saveLocals(std::vector<uint8_t> &dest) = 0;
+    virtual void restoreLocals(const std::vector<uint8_t> &src) = 0;
     virtual const uint8_t *getData() = 0;
     virtual uint32_t getDataLen() = 0;
     virtual uint16_t getRelocSegment() = 0;
@@ -282,6 +298,24 @@ class SBTProcess {
     jmp_buf jmp_yield;
 };
 
+/*
+ * SBTProcessState --
+ *
+ *    Resumable state for an SBTProcess, for save-states. The translated
+ *    code's stack only lives during run(), so between runs this is all
+ *    we need besides memory. Locals are the generated per-instance
+ *    struct, including the clock and any state declared by patches.
+ */
+
+class SBTProcessState {
+  public:
+    SBTRegs reg;
+    SBTRegs default_reg;
+    SBTProcess::continue_func_t continue_func;
+    SBTProcess::continue_func_t default_func;
+    std::vector<uint8_t> locals;
+};
+
 /*
  * SBTSegmentCache --
  *
@@ -333,17 +367,24 @@ static SBT_INLINE void write16(uint8_t *ptr, uint16_t x) {
     class name final : public SBTProcess {                                     \
       public:                                                                  \
         name(Hardware *hardware);                                              \
+        ~name();                                                               \
+        struct Locals;                                                         \
         virtual int getAddress(SBTAddressId id);                               \
         virtual const char *getFilename();                                     \
+        virtual uint32_t getClock();                                           \
                                                                                \
       private:                                                                 \
         virtual void loadEnvironment(SBTStack *stack, SBTRegs reg);            \
         virtual void flushOutput();                                            \
+        virtual void saveLocals(std::vector<uint8_t> &dest);                   \
+        virtual void restoreLocals(const std::vector<uint8_t> &src);           \
         virtual const uint8_t *getData();                                      \
         virtual uint32_t getDataLen();                                         \
         virtual uint16_t getRelocSegment();                                    \
         virtual uint16_t getEntryCS();                                         \
         virtual continue_func_t getFunction(SBTAddressId id);                  \
+                                                                               \
+        Locals *locals;                                                        \
     };
 
 #define SBT_STATIC_PROCESS(hw, name) static name name##_##hw##_inst(&hw);
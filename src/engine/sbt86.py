@@ -286,14 +286,17 @@ class Indirect:
         _, offset = self.genAddr()
         mem = "g.s.%s[(uint16_t)(%s)]" % (self.segment.name, offset)
 
+        # Stores also mark the page dirty. The stack lives outside emulated
+        # memory, so only these need it. Builds with ENGINE_DIRTY_PAGES=0
+        # compile the marking away.
         if self.width == 1:
             if mode == "w":
-                return "%s=(" % mem
+                return "*g.hw->markDirty(&%s)=(" % mem
             else:
                 return mem
         elif self.width == 2:
             if mode == "w":
-                return "write16(&%s," % mem
+                return "write16(g.hw->markDirty16(&%s)," % mem
             else:
                 return "read16(&%s)" % mem
         else:
@@ -1673,6 +1676,7 @@ class DOSBinary(BinaryImage):
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include "sbt86.h"
 #include "hardware.h"
 
@@ -1688,30 +1692,40 @@ class DOSBinary(BinaryImage):
 
 SBT_DECL_PROCESS(%(className)s);
 
-%(className)s::%(className)s(Hardware *hardware)
-{
-    this->hardware = hardware;
-    hardware->registerProcess(this);
-}
-
 /*
- * Local cache of registers and process pointer.
+ * Local cache of registers and process pointer, plus any state declared by
+ * patches. Each process instance owns one, and translated code finds the
+ * running instance's locals through a thread-local pointer.
  */
-struct ProcessLocals {
+struct %(className)s::Locals {
     SBTRegs r;
     SBTSegmentCache s;
     uint32_t clock;
     SBTProcess *proc;
     SBTStack *stack;
     Hardware *hw;
+%(_locals)s
 };
-static ProcessLocals gProcessLocals = {};
+typedef %(className)s::Locals ProcessLocals;
+static thread_local ProcessLocals *gProcessLocals;
 
 #define SBT_LOCALS \
-    ProcessLocals& g = gProcessLocals; \
+    ProcessLocals& g = *gProcessLocals; \
     SBTRegs& r = g.r; \
     (void)r
 
+%(className)s::%(className)s(Hardware *hardware)
+{
+    locals = new Locals();
+    this->hardware = hardware;
+    hardware->registerProcess(this);
+}
+
+%(className)s::~%(className)s()
+{
+    delete locals;
+}
+
 static const uint8_t dataImage[] = {
 %(dataImage)s};
 
@@ -1749,6 +1763,7 @@ const char *%(className)s::getFilename()
 
 void %(className)s::loadEnvironment(SBTStack *stack, SBTRegs reg)
 {
+    gProcessLocals = locals;
     SBT_LOCALS;
     g.stack = stack;
     r = reg;
@@ -1760,8 +1775,24 @@ void %(className)s::loadEnvironment(SBTStack *stack, SBTRegs reg)
 
 void %(className)s::flushOutput()
 {
-    SBT_LOCALS;
-    g.hw->output.pushDelay(g.clock, OUT_DELAY_FLUSH);
+    hardware->output.pushDelay(locals->clock, OUT_DELAY_FLUSH);
+}
+
+uint32_t %(className)s::getClock()
+{
+    return locals->clock;
+}
+
+void %(className)s::saveLocals(std::vector<uint8_t> &dest)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(locals);
+    dest.assign(bytes, bytes + sizeof *locals);
+}
+
+void %(className)s::restoreLocals(const std::vector<uint8_t> &src)
+{
+    assert(src.size() == sizeof *locals);
+    memcpy(locals, &src[0], sizeof *locals);
 }
 
 SBTProcess::continue_func_t %(className)s::getFunction(SBTAddressId id)
@@ -1799,6 +1830,7 @@ int %(className)s::getAddress(SBTAddressId id)
         self._hooks = {}
         self._traces = []
         self._decls = ""
+        self._locals = ""
         self._dynBranches = {}
         self._publishedAddresses = {}
         self._publishedFunctions = {}
@@ -1853,6 +1885,14 @@ int %(className)s::getAddress(SBTAddressId id)
         """
         self._decls = "%s\n%s\n" % (self._decls, code)
 
+    def local(self, code):
+        """Add a member declaration to the generated per-process locals.
+        Patches can use these like globals via 'g', but each process
+        instance gets its own copy. Locals start out zeroed, and they're
+        included in save-states.
+        """
+        self._locals = "%s    %s\n" % (self._locals, code)
+
     def publishAddress(self, enum, addr):
         """Provide an address that can be looked up via getAddress() at runtime."""
         if enum in self._publishedAddresses:
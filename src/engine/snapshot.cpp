@@ -0,0 +1,63 @@
+#include "snapshot.h"
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+
+uint64_t PageSnapshot::nextId() {
+    // Snapshots are taken on worker threads too
+    static std::atomic<uint64_t> counter(0);
+    return ++counter;
+}
+
+unsigned PageSnapshot::capture(const uint8_t *data, size_t size,
+                               const PageSnapshot *previous,
+                               const uint8_t *dirty) {
+    const size_t count = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    unsigned new_pages = 0;
+
+    if (previous && previous->pages.size() != count) {
+        previous = nullptr;
+    }
+    pages.resize(count);
+    id = nextId();
+
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *src = data + i * PAGE_SIZE;
+        const size_t len = std::min<size_t>(PAGE_SIZE, size - i * PAGE_SIZE);
+
+        if (previous && dirty && !dirty[i]) {
+            pages[i] = previous->pages[i];
+        } else if (previous && !memcmp(previous->pages[i]->bytes, src, len)) {
+            pages[i] = previous->pages[i];
+        } else {
+            std::shared_ptr<Page> page(new Page);
+            memcpy(page->bytes, src, len);
+            pages[i] = page;
+            new_pages++;
+        }
+    }
+    return new_pages;
+}
+
+unsigned PageSnapshot::restore(uint8_t *data, size_t size, uint8_t *changed,
+                               const uint8_t *dirty) const {
+    // Resetting to a recent snapshot touches few pages, and comparing is
+    // cheaper than rewriting the rest.
+    assert(pages.size() == (size + PAGE_SIZE - 1) / PAGE_SIZE);
+    unsigned copied = 0;
+    for (size_t i = 0; i < pages.size(); i++) {
+        if (dirty && !dirty[i]) {
+            continue;
+        }
+        const size_t len = std::min<size_t>(PAGE_SIZE, size - i * PAGE_SIZE);
+        uint8_t *dest = data + i * PAGE_SIZE;
+        if (memcmp(dest, pages[i]->bytes, len)) {
+            memcpy(dest, pages[i]->bytes, len);
+            copied++;
+            if (changed) {
+                changed[i] = 1;
+            }
+        }
+    }
+    return copied;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "filesystem.h"
+#include "input.h"
+#include "output.h"
+#include "sbt86.h"
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+// A copy of one memory region, split into 4 KB pages. Pages are immutable once
+// captured, and shared with the previous snapshot wherever they are unchanged.
+class PageSnapshot {
+  public:
+    static constexpr unsigned PAGE_SIZE = 4096;
+
+    struct Page {
+        uint8_t bytes[PAGE_SIZE];
+    };
+
+    PageSnapshot() : id(0) {}
+
+    // Copy a region, sharing pages that still match the previous snapshot of
+    // the same region. Returns the number of newly allocated pages.
+    //
+    // If 'dirty' is given, it has one byte per page, and the caller promises
+    // that pages with a zero byte haven't changed since 'previous'. Those
+    // are shared without comparing them.
+    unsigned capture(const uint8_t *data, size_t size,
+                     const PageSnapshot *previous = nullptr,
+                     const uint8_t *dirty = nullptr);
+
+    // Copy back only the pages that differ, returning how many did. If
+    // 'changed' is given, it gets a nonzero byte for each copied page.
+    //
+    // 'dirty' works like it does for capture(), with the caller promising
+    // that pages with a zero byte still match this snapshot. Those are
+    // skipped without comparing them.
+    unsigned restore(uint8_t *data, size_t size, uint8_t *changed = nullptr,
+                     const uint8_t *dirty = nullptr) const;
+
+    size_t getPageCount() const { return pages.size(); }
+
+    // Identifies the contents. It changes on every capture or modification,
+    // and copies of a snapshot keep it.
+    uint64_t getId() const { return id; }
+
+    // Pages compare equal by pointer when they were shared during capture
+    const std::shared_ptr<const Page> &getPage(size_t index) const {
+        return pages[index];
+    }
+    void setPage(size_t index, std::shared_ptr<const Page> page) {
+        pages[index] = page;
+        id = nextId();
+    }
+    void resize(size_t count) {
+        pages.resize(count);
+        id = nextId();
+    }
+
+  private:
+    std::vector<std::shared_ptr<const Page>> pages;
+    uint64_t id;
+
+    static uint64_t nextId();
+};
+
+// Everything in a save-state except the large memory regions
+struct HardwareState {
+    // Current process by filename, so states can move between instances
+    const char *process;
+    SBTProcessState process_state;
+    DOSFilesystem::State fs;
+    InputBuffer input;
+    OutputState output;
+    uint8_t port61;
+
+    HardwareState() : process(nullptr), port61(0) {}
+};
+
+// Save-state for an entire Hardware instance. It can be loaded into any
+// instance with the same set of processes.
+struct HardwareSnapshot {
+    PageSnapshot mem;
+    PageSnapshot backbuffer;
+    PageSnapshot save_buffer;
+    PageSnapshot autosave_buffer;
+    HardwareState state;
+
+    // Pages allocated by this snapshot rather than shared
+    unsigned new_pages;
+
+    HardwareSnapshot() : new_pages(0) {}
+};
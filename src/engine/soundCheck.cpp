@@ -0,0 +1,107 @@
+#include "output.h"
+#include "soundTrace.h"
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Native runner for sound traces, built and run with "make sound-check".
+//
+//    sound-check trace.u32 golden.f32 iir|blep rate [min_snr_db]
+//
+// Traces are the Uint32Array from stopSoundTrace(), and golden PCM is the
+// Float32Array from renderSoundTrace(), both saved as raw little-endian
+// files. The exit status is nonzero unless the replay matches the golden
+// length exactly and reaches the minimum SNR. With "-w" in place of the
+// SNR, the golden file is written from this replay instead.
+
+static const double DEFAULT_MIN_SNR_DB = 90.0;
+
+static bool readFile(const char *path, std::vector<uint8_t> &data) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    uint8_t buffer[0x10000];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof buffer, f)) > 0) {
+        data.insert(data.end(), buffer, buffer + count);
+    }
+    fclose(f);
+    return true;
+}
+
+struct CollectSink : public SoundSink {
+    std::vector<float> pcm;
+    unsigned effects;
+
+    CollectSink() : effects(0) {}
+
+    virtual void renderSound(const float *samples, uint32_t count,
+                             uint32_t) {
+        pcm.insert(pcm.end(), samples, samples + count);
+        effects++;
+    }
+};
+
+int main(int argc, char **argv) {
+    if (argc < 5 || (strcmp(argv[3], "iir") && strcmp(argv[3], "blep"))) {
+        fprintf(stderr, "usage: %s trace.u32 golden.f32 iir|blep rate "
+                        "[min_snr_db | -w]\n",
+                argv[0]);
+        return 2;
+    }
+    const SpeakerSynthesis synthesis =
+        strcmp(argv[3], "iir") ? SPEAKER_SYNTH_BLEP : SPEAKER_SYNTH_IIR;
+    const uint32_t rate = strtoul(argv[4], nullptr, 0);
+    const bool write_golden = argc > 5 && !strcmp(argv[5], "-w");
+    const double min_snr_db =
+        argc > 5 && !write_golden ? strtod(argv[5], nullptr)
+                                  : DEFAULT_MIN_SNR_DB;
+
+    std::vector<uint8_t> bytes;
+    if (!readFile(argv[1], bytes)) {
+        return 2;
+    }
+    SoundTrace trace;
+    trace.words.resize(bytes.size() / sizeof(uint32_t));
+    memcpy(trace.words.data(), bytes.data(),
+           trace.words.size() * sizeof(uint32_t));
+
+    static ColorTable colorTable;
+    static OutputQueue queue(colorTable);
+    CollectSink sink;
+    const uint32_t samples = trace.replay(sink, queue, synthesis, rate);
+
+    if (write_golden) {
+        FILE *f = fopen(argv[2], "wb");
+        if (!f || fwrite(sink.pcm.data(), sizeof(float), samples, f) !=
+                      samples) {
+            perror(argv[2]);
+            return 2;
+        }
+        fclose(f);
+        printf("%s: wrote %u effects, %u samples\n", argv[2], sink.effects,
+               samples);
+        return 0;
+    }
+
+    bytes.clear();
+    if (!readFile(argv[2], bytes)) {
+        return 2;
+    }
+    std::vector<float> golden(bytes.size() / sizeof(float));
+    memcpy(golden.data(), bytes.data(), golden.size() * sizeof(float));
+
+    SoundCompare compare;
+    compare.compare(sink.pcm.data(), golden.data(),
+                    std::min<size_t>(samples, golden.size()));
+    const double snr = compare.snr();
+    const bool pass = samples == golden.size() && snr >= min_snr_db;
+
+    printf("%s: %u effects, %u samples (golden %u), SNR %.1f dB, %s\n",
+           argv[1], sink.effects, samples, unsigned(golden.size()), snr,
+           pass ? "pass" : "FAIL");
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+#include "soundTrace.h"
+#include "output.h"
+#include <emscripten.h>
+#include <math.h>
+#include <stdio.h>
+
+void SoundTrace::push(Event event, uint32_t timestamp) {
+    if (words.size() + 2 <= MAX_WORDS) {
+        words.push_back(event);
+        words.push_back(timestamp);
+    }
+}
+
+uint32_t SoundTrace::replay(SoundSink &sink, OutputQueue &queue,
+                            SpeakerSynthesis synthesis, uint32_t rate) const {
+    struct CountingSink : public SoundSink {
+        SoundSink *next;
+        uint32_t samples;
+
+        virtual void renderSound(const float *pcm, uint32_t count,
+                                 uint32_t rate) {
+            samples += count;
+            next->renderSound(pcm, count, rate);
+        }
+    } counter;
+    counter.next = &sink;
+    counter.samples = 0;
+
+    queue.clear();
+    queue.setTimeReference(0);
+    queue.setSpeakerSynthesis(synthesis);
+    queue.setAudioRate(rate);
+    queue.setSoundSink(&counter);
+
+    // Drain the queue on each flush, like the main loop does once per frame,
+    // and occasionally during long runs of speaker events to keep it from
+    // filling up.
+    const uint32_t drain_interval = OutputQueue::MAX_BUFFERED_EVENTS / 2;
+    uint32_t events_since_drain = 0;
+
+    for (size_t i = 0; i + 1 < words.size(); i += 2) {
+        const uint32_t timestamp = words[i + 1];
+        switch (words[i]) {
+        case SPEAKER:
+            queue.pushSpeakerTimestamp(timestamp);
+            break;
+        case FLUSH:
+            queue.pushDelay(timestamp, OUT_DELAY_FLUSH);
+            break;
+        case REFERENCE:
+            queue.setTimeReference(timestamp);
+            break;
+        }
+        if (words[i] == FLUSH || ++events_since_drain >= drain_interval) {
+            while (queue.run()) {
+            }
+            events_since_drain = 0;
+        }
+    }
+    while (queue.run()) {
+    }
+
+    queue.setSoundSink(nullptr);
+    return counter.samples;
+}
+
+void SoundTrace::benchmark(OutputQueue &queue, uint32_t rate) const {
+    static const char *names[] = {"iir", "blep"};
+    const unsigned iterations = 4;
+
+    struct NullSink : public SoundSink {
+        uint32_t effects;
+        virtual void renderSound(const float *, uint32_t, uint32_t) {
+            effects++;
+        }
+    } sink;
+
+    for (unsigned s = SPEAKER_SYNTH_IIR; s <= SPEAKER_SYNTH_BLEP; s++) {
+        uint32_t samples = 0;
+        sink.effects = 0;
+        double start = emscripten_get_now();
+        for (unsigned i = 0; i < iterations; i++) {
+            samples += replay(sink, queue, SpeakerSynthesis(s), rate);
+        }
+        double msec = emscripten_get_now() - start;
+
+        printf("SOUND, trace %s at %d Hz: %d effects, %.2f sec, %.1f "
+               "Msamples/sec\n",
+               names[s], rate, sink.effects / iterations,
+               double(samples / iterations) / rate,
+               samples / msec / 1000.0);
+    }
+}
+
+void SoundCompare::compare(const float *pcm, const float *golden,
+                           uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        const double error = double(pcm[i]) - double(golden[i]);
+        signal_energy += double(golden[i]) * golden[i];
+        noise_energy += error * error;
+    }
+}
+
+double SoundCompare::snr() {
+    if (noise_energy == 0.0) {
+        return INFINITY;
+    }
+    return 10.0 * log10(signal_energy / noise_energy);
+}
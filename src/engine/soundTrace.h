@@ -0,0 +1,62 @@
+#pragma once
+#include "speaker.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class OutputQueue;
+
+// Receives finished sound effects from an OutputQueue, in place of Javascript.
+class SoundSink {
+  public:
+    virtual void renderSound(const float *pcm, uint32_t count,
+                             uint32_t rate) = 0;
+};
+
+// Recording of everything that decides how OutputQueue renders sound: speaker
+// toggles, and the delay flushes that split them into separate effects. The
+// trace is a flat array of (event, timestamp) word pairs, so it can be saved
+// from Javascript as-is and replayed headlessly later.
+class SoundTrace {
+  public:
+    enum Event : uint32_t {
+        SPEAKER = 0,
+        FLUSH = 1,
+        REFERENCE = 2,
+    };
+
+    // Recording stops at 2 MB, a few minutes of continuous sound
+    static constexpr size_t MAX_WORDS = 1 << 19;
+
+    std::vector<uint32_t> words;
+
+    void clear() { words.clear(); }
+    void push(Event event, uint32_t timestamp);
+
+    // Replay through an OutputQueue, sending each effect to the sink.
+    // Returns the total number of samples rendered. The queue is cleared
+    // first, so it must not be one the game is using. Queues are over 2 MB,
+    // mostly frame buffers, so keep one around for replays instead of
+    // making a new one each time.
+    uint32_t replay(SoundSink &sink, OutputQueue &queue,
+                    SpeakerSynthesis synthesis, uint32_t rate) const;
+
+    // Log replay throughput for each synthesis type to the console.
+    void benchmark(OutputQueue &queue, uint32_t rate) const;
+};
+
+// Accumulates the difference between rendered and golden PCM, where the golden
+// recording is every effect from an earlier replay, concatenated.
+class SoundCompare {
+  public:
+    SoundCompare() : signal_energy(0.0), noise_energy(0.0) {}
+
+    void compare(const float *pcm, const float *golden, uint32_t count);
+
+    // Signal to noise ratio in dB, with the golden PCM as signal
+    double snr();
+
+  private:
+    double signal_energy;
+    double noise_energy;
+};
@@ -0,0 +1,414 @@
+#include "speaker.h"
+#include "output.h"
+#include <algorithm>
+#include <emscripten.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// Band-limited step residuals, indexed by the fractional sample phase of a
+// speaker toggle. Each row is the difference between a windowed-sinc step and
+// the naive step, over BLEP_TAPS samples centered on the toggle.
+static float blep_residual[SpeakerRenderer::BLEP_PHASES]
+                          [SpeakerRenderer::BLEP_TAPS];
+static bool blep_residual_ready = false;
+
+static void initBLEPResidual() {
+    const unsigned taps = SpeakerRenderer::BLEP_TAPS;
+    const unsigned phases = SpeakerRenderer::BLEP_PHASES;
+    const unsigned grid_size = taps * phases + 1;
+    const double cutoff = 0.45; // Cycles per sample, just under Nyquist
+
+    // Integrate a Blackman-windowed sinc on a grid of 1/phases sample
+    std::vector<double> impulse(grid_size);
+    for (unsigned i = 0; i < grid_size; i++) {
+        const double t = double(i) / phases - taps / 2.0;
+        const double x = M_PI * 2.0 * cutoff * t;
+        const double sinc = x == 0.0 ? 1.0 : sin(x) / x;
+        const double window = 0.42 + 0.5 * cos(2.0 * M_PI * t / taps) +
+                              0.08 * cos(4.0 * M_PI * t / taps);
+        impulse[i] = 2.0 * cutoff * sinc * window;
+    }
+    std::vector<double> step(grid_size);
+    step[0] = 0.0;
+    for (unsigned i = 1; i < grid_size; i++) {
+        step[i] = step[i - 1] + (impulse[i - 1] + impulse[i]) / (2.0 * phases);
+    }
+
+    for (unsigned phase = 0; phase < phases; phase++) {
+        for (unsigned k = 0; k < taps; k++) {
+            // Sample k is (k - taps/2 + 1) whole samples after the toggle's
+            // sample, and the toggle is phase/phases into that sample.
+            const int j = int(k) - int(taps / 2 - 1);
+            const unsigned grid_index = (j + taps / 2) * phases - phase;
+            const double naive = (j > 0 || (j == 0 && phase == 0)) ? 1.0 : 0.0;
+            blep_residual[phase][k] =
+                float(step[grid_index] / step[grid_size - 1] - naive);
+        }
+    }
+    blep_residual_ready = true;
+}
+
+// IIR filter design from notes/sound-filter-design.ipynb, as second-order
+// stages at IIR_DESIGN_HZ. Other sample rates use a bilinear remapping of
+// these stages, which preserves the response well below Nyquist.
+static const double iir_design_stages[SpeakerRenderer::IIR_STAGES][6] = {
+    {0.009053953112749067, -0.018107906225498134, 0.009053953112749067, 1.0,
+     -1.9796374795399938, 0.9798427166181983}, // 0 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9816736138512914,
+     0.9818400241394235}, // 1 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9835061664508131,
+     0.983641081639581}, // 2 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.985155486977734,
+     0.9852648579720966}, // 3 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9866398923976099,
+     0.9867285483734656}, // 4 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9879758696565433,
+     0.9880477287809956}, // 5 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9891782582335584,
+     0.9892364989957404}, // 6 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9902604145578904,
+     0.9903076150206832}, // 7 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9912343600727092,
+     0.9912726110131748}, // 8 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9921109145571194,
+     0.9921419113636548}, // 9 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.992899816163347,
+     0.9929249334576205}, // 10 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9936098294848998,
+     0.9936301817009935}, // 11 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.994248842843328,
+     0.9942653333957537}, // 12 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9948239558648986,
+     0.9948373170469392}, // 13 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9953415583132041,
+     0.9953523836673354}, // 14 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.995807401048457,
+     0.9958161716249172}, // 15 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9962266598981226,
+     0.9962337655524821}, // 16 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9966039931458075,
+     0.9966097498105327}, // 17 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9969435932751376,
+     0.9969482569645431}, // 18 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.997249233542087,
+     0.9972530117072836}, // 19 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9975243098921462,
+     0.9975273706265284}, // 20 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9977718786872791,
+     0.9977743581887931}, // 21 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9979946906612989,
+     0.9979966992811273}, // 22 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9981952214805052,
+     0.9981968486256011}, // 23 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9983756992488464,
+     0.9983770173552453}, // 24 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9985381292629996,
+     0.9985391970158521}, // 25 of 28
+    {1.0, 2.0, 1.0, 1.0, -1.9603951329819316,
+     0.9623976551531928}, // 26 of 28
+    {1.0, -2.0, 1.0, 1.0, -1.9859539013699274,
+     0.986219511050537}, // 27 of 28
+};
+
+SpeakerRenderer::SpeakerRenderer() : synthesis(SPEAKER_SYNTH_IIR), rate(0) {
+    if (!blep_residual_ready) {
+        initBLEPResidual();
+    }
+    setRate(IIR_DESIGN_HZ);
+}
+
+void SpeakerRenderer::setSynthesis(SpeakerSynthesis s) { synthesis = s; }
+
+void SpeakerRenderer::setRate(uint32_t hz) {
+    assert(hz > 0);
+    if (hz == rate) {
+        return;
+    }
+    rate = hz;
+
+    // Substituting the old z in terms of the new one is itself a bilinear
+    // transform, so each biquad stays a biquad:
+    //   z_old^-1 = (p + q z^-1) / (q + p z^-1), with k = new/old, p = 1-k,
+    //   q = 1+k
+    const double k = double(hz) / double(IIR_DESIGN_HZ);
+    const double p = 1.0 - k;
+    const double q = 1.0 + k;
+    for (unsigned stage = 0; stage < IIR_STAGES; stage++) {
+        const double *design = iir_design_stages[stage];
+        double mapped[6];
+        for (unsigned half = 0; half < 6; half += 3) {
+            const double c0 = design[half + 0];
+            const double c1 = design[half + 1];
+            const double c2 = design[half + 2];
+            mapped[half + 0] = c0 * q * q + c1 * p * q + c2 * p * p;
+            mapped[half + 1] =
+                2.0 * p * q * c0 + (p * p + q * q) * c1 + 2.0 * p * q * c2;
+            mapped[half + 2] = c0 * p * p + c1 * p * q + c2 * q * q;
+        }
+        const double a0 = mapped[3];
+        for (unsigned i = 0; i < 6; i++) {
+            iir_stages[stage][i] = float(mapped[i] / a0);
+        }
+    }
+
+    // To the remapped filter, a one-sample impulse has an area proportional to
+    // the sample period. Scale impulses with rate to keep the level constant.
+    iir_impulse = float(double(hz) / double(IIR_DESIGN_HZ));
+
+    // BLEP output filter: a second order Butterworth highpass to remove DC,
+    // and a single pole lowpass for roughly the same high frequency slope as
+    // the IIR design.
+    const double highpass_w = 2.0 * M_PI * 110.0 / hz;
+    const double highpass_alpha = sin(highpass_w) / (2.0 * M_SQRT1_2);
+    const double highpass_a0 = 1.0 + highpass_alpha;
+    blep_highpass[0] = float((1.0 + cos(highpass_w)) / 2.0 / highpass_a0);
+    blep_highpass[1] = -2.f * blep_highpass[0];
+    blep_highpass[2] = blep_highpass[0];
+    blep_highpass[3] = float(-2.0 * cos(highpass_w) / highpass_a0);
+    blep_highpass[4] = float((1.0 - highpass_alpha) / highpass_a0);
+    blep_lowpass_pole = float(exp(-2.0 * M_PI * 392.0 / hz));
+}
+
+uint32_t SpeakerRenderer::render(const uint32_t *timestamps, uint32_t count,
+                                 float *pcm, uint32_t pcm_limit) {
+    if (count == 0) {
+        return 0;
+    }
+    switch (synthesis) {
+    case SPEAKER_SYNTH_BLEP:
+        return renderBLEP(timestamps, count, pcm, pcm_limit);
+    case SPEAKER_SYNTH_IIR:
+    default:
+        return renderIIR(timestamps, count, pcm, pcm_limit);
+    }
+}
+
+uint32_t SpeakerRenderer::renderIIR(const uint32_t *timestamps, uint32_t count,
+                                    float *pcm, uint32_t pcm_limit) {
+    // Generate a train of alternating single-sample impulses at each speaker
+    // toggle, and filter it into a square-ish wave with no DC bias.
+
+    const uint32_t padding_samples = rate / 10;
+    float filter_state[IIR_STAGES][2] = {{0}};
+
+    const float cpu_clocks_per_sample =
+        float(OutputInterface::CPU_CLOCK_HZ) / float(rate);
+
+    uint32_t sample_count = 0;
+    uint32_t sample_limit = pcm_limit;
+    uint32_t next_timestamp = 1;
+    uint32_t ref_timestamp = timestamps[0];
+
+    float clocks_until_impulse = 0.f;
+    float impulse = iir_impulse;
+
+    while (sample_count < sample_limit) {
+        float signal = 0.f;
+
+        clocks_until_impulse -= cpu_clocks_per_sample;
+        if (clocks_until_impulse < 0.f) {
+            // Impulse here, and set up for the next one
+            signal = impulse;
+            impulse = -impulse;
+
+            if (next_timestamp >= count) {
+                // No more timestamps; apply the padding and finish.
+                sample_limit =
+                    std::min(sample_limit, sample_count + padding_samples);
+                clocks_until_impulse = float(UINT32_MAX);
+            } else {
+                uint32_t timestamp = timestamps[next_timestamp++];
+                uint32_t elapsed_time = timestamp - ref_timestamp;
+                ref_timestamp = timestamp;
+                clocks_until_impulse += float(elapsed_time);
+            }
+        }
+
+#pragma unroll
+        for (size_t stage = 0; stage < IIR_STAGES; stage++) {
+            // IIR filter implemented as second-order stages
+            const float B0 = iir_stages[stage][0];
+            const float B1 = iir_stages[stage][1];
+            const float B2 = iir_stages[stage][2];
+            const float A0 = iir_stages[stage][3];
+            const float A1 = iir_stages[stage][4];
+            const float A2 = iir_stages[stage][5];
+            assert(A0 == 1.f); // wants to be static_assert but the loop
+                               // isn't constexpr
+
+            float &s1 = filter_state[stage][0];
+            float &s2 = filter_state[stage][1];
+
+            const float x = signal;
+            const float y = B0 * x + s1;
+            s1 = s2 + B1 * x - A1 * y;
+            s2 = B2 * x - A2 * y;
+            signal = y;
+        }
+
+        pcm[sample_count++] = signal;
+    }
+
+    return sample_count;
+}
+
+uint32_t SpeakerRenderer::renderBLEP(const uint32_t *timestamps,
+                                     uint32_t count, float *pcm,
+                                     uint32_t pcm_limit) {
+    // Synthesize the speaker's square wave directly, correcting each edge with
+    // a band-limited step placed at the toggle's exact sub-sample phase. Cost
+    // is BLEP_TAPS per toggle plus a short filter per sample.
+
+    const uint32_t padding_samples = rate / 10;
+    const double cpu_clocks_per_sample =
+        double(OutputInterface::CPU_CLOCK_HZ) / double(rate);
+    constexpr unsigned half_taps = BLEP_TAPS / 2;
+
+    // Steps are delayed by half the table, so residuals never start before
+    // the first sample. The buffer is zeroed just ahead of where we write.
+    uint32_t sample_count = 0;
+    uint32_t zeroed_until = 0;
+    float level = 0.f;
+    float delta = 1.f;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const double position =
+            half_taps +
+            double(timestamps[i] - timestamps[0]) / cpu_clocks_per_sample;
+        uint32_t sample = uint32_t(position);
+        unsigned phase =
+            unsigned((position - double(sample)) * BLEP_PHASES + 0.5);
+        if (phase == BLEP_PHASES) {
+            sample++;
+            phase = 0;
+        }
+        if (sample >= pcm_limit) {
+            break;
+        }
+
+        const uint32_t window_begin = sample - (half_taps - 1);
+        const uint32_t window_end =
+            std::min<uint32_t>(pcm_limit, window_begin + BLEP_TAPS);
+        if (zeroed_until < window_end) {
+            memset(pcm + zeroed_until, 0,
+                   (window_end - zeroed_until) * sizeof pcm[0]);
+            zeroed_until = window_end;
+        }
+
+        // Hold the previous level up until the toggle
+        const uint32_t first_new_sample = phase ? sample + 1 : sample;
+        while (sample_count < first_new_sample) {
+            pcm[sample_count++] += level;
+        }
+        level += delta;
+
+        const float *residual = blep_residual[phase];
+        for (uint32_t s = window_begin; s < window_end; s++) {
+            pcm[s] += delta * residual[s - window_begin];
+        }
+        delta = -delta;
+    }
+
+    // Hold the final level through the padding, then filter everything
+    const uint32_t sample_limit =
+        std::min(pcm_limit, sample_count + padding_samples);
+    if (zeroed_until < sample_limit) {
+        memset(pcm + zeroed_until, 0,
+               (sample_limit - zeroed_until) * sizeof pcm[0]);
+    }
+    while (sample_count < sample_limit) {
+        pcm[sample_count++] += level;
+    }
+
+    // Short output filter, with coefficients from setRate()
+    const float B0 = blep_highpass[0];
+    const float B1 = blep_highpass[1];
+    const float B2 = blep_highpass[2];
+    const float A1 = blep_highpass[3];
+    const float A2 = blep_highpass[4];
+    const float lowpass_pole = blep_lowpass_pole;
+
+    float s1 = 0.f, s2 = 0.f, lowpass = 0.f;
+    for (uint32_t s = 0; s < sample_count; s++) {
+        const float x = pcm[s];
+        const float y = B0 * x + s1;
+        s1 = s2 + B1 * x - A1 * y;
+        s2 = B2 * x - A2 * y;
+        lowpass = y + lowpass_pole * (lowpass - y);
+        pcm[s] = lowpass;
+    }
+
+    return sample_count;
+}
+
+static double goertzelPower(const float *pcm, uint32_t count, double hz,
+                            uint32_t rate) {
+    const double coeff = 2.0 * cos(2.0 * M_PI * hz / rate);
+    double s1 = 0.0, s2 = 0.0;
+    for (uint32_t i = 0; i < count; i++) {
+        const double s = pcm[i] + coeff * s1 - s2;
+        s2 = s1;
+        s1 = s;
+    }
+    return s1 * s1 + s2 * s2 - coeff * s1 * s2;
+}
+
+void SpeakerRenderer::benchmark(uint32_t rate) {
+    // Square waves whose half-period is a whole number of CPU clocks. Each
+    // tone plays for three seconds, and one second is analyzed after the
+    // filters settle. Odd harmonics land on exact bins, and everything else
+    // in the analysis window is aliasing or filter noise.
+
+    static const unsigned tones_hz[] = {530, 2650};
+    static const char *names[] = {"iir", "blep"};
+    const unsigned iterations = 4;
+    const uint32_t hz = rate;
+
+    std::vector<float> pcm(rate * OutputQueue::AUDIO_BUFFER_SECONDS);
+    std::vector<uint32_t> timestamps;
+    SpeakerRenderer renderer;
+    renderer.setRate(rate);
+
+    for (unsigned t = 0; t < sizeof tones_hz / sizeof tones_hz[0]; t++) {
+        const unsigned tone = tones_hz[t];
+        const uint32_t half_period = OutputInterface::CPU_CLOCK_HZ / tone / 2;
+        timestamps.clear();
+        for (uint32_t clock = 0; clock < 3 * OutputInterface::CPU_CLOCK_HZ;
+             clock += half_period) {
+            timestamps.push_back(clock);
+        }
+
+        for (unsigned s = SPEAKER_SYNTH_IIR; s <= SPEAKER_SYNTH_BLEP; s++) {
+            renderer.setSynthesis(SpeakerSynthesis(s));
+
+            uint32_t samples = 0;
+            double start = emscripten_get_now();
+            for (unsigned i = 0; i < iterations; i++) {
+                samples = renderer.render(&timestamps[0], timestamps.size(),
+                                          &pcm[0], pcm.size());
+            }
+            double msec = emscripten_get_now() - start;
+
+            const float *window = &pcm[hz];
+            double energy = 0.0, harmonic_energy = 0.0;
+            for (uint32_t i = 0; i < hz; i++) {
+                energy += double(window[i]) * window[i];
+            }
+            for (unsigned harmonic = tone; harmonic < hz / 2;
+                 harmonic += 2 * tone) {
+                harmonic_energy += 2.0 * goertzelPower(window, hz, harmonic, hz) /
+                                   double(hz);
+            }
+            const double alias_db =
+                10.0 * log10(std::max(energy - harmonic_energy, 1e-30) /
+                             harmonic_energy);
+
+            printf("SOUND, %s %d Hz at %d Hz: %.1f Msamples/sec, rms %.4f, "
+                   "alias %.1f dB\n",
+                   names[s], tone, rate, samples * iterations / msec / 1000.0,
+                   sqrt(energy / hz), alias_db);
+        }
+    }
+}
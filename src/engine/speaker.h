@@ -0,0 +1,46 @@
+#pragma once
+#include <stdint.h>
+
+enum SpeakerSynthesis {
+    SPEAKER_SYNTH_IIR,
+    SPEAKER_SYNTH_BLEP,
+};
+
+// Converts a run of PC speaker toggle timestamps, in CPU clocks, into PCM.
+class SpeakerRenderer {
+  public:
+    SpeakerRenderer();
+
+    void setSynthesis(SpeakerSynthesis synthesis);
+    SpeakerSynthesis getSynthesis() { return synthesis; }
+
+    // Output sample rate, in Hz. Filters are recalculated on change.
+    void setRate(uint32_t hz);
+    uint32_t getRate() { return rate; }
+
+    // Render one sound effect, returning the number of samples written.
+    uint32_t render(const uint32_t *timestamps, uint32_t count, float *pcm,
+                    uint32_t pcm_limit);
+
+    // Log the cost and aliasing of each synthesis type to the console.
+    static void benchmark(uint32_t rate);
+
+    static constexpr unsigned BLEP_TAPS = 16;
+    static constexpr unsigned BLEP_PHASES = 64;
+    static constexpr unsigned IIR_STAGES = 28;
+    static constexpr uint32_t IIR_DESIGN_HZ = 48000;
+
+  private:
+    SpeakerSynthesis synthesis;
+    uint32_t rate;
+
+    float iir_stages[IIR_STAGES][6];
+    float iir_impulse;
+    float blep_highpass[5];
+    float blep_lowpass_pole;
+
+    uint32_t renderIIR(const uint32_t *timestamps, uint32_t count, float *pcm,
+                       uint32_t pcm_limit);
+    uint32_t renderBLEP(const uint32_t *timestamps, uint32_t count,
+                        float *pcm, uint32_t pcm_limit);
+};
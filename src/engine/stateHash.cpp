@@ -0,0 +1,290 @@
+#include "stateHash.h"
+#include "output.h"
+#include <string.h>
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(uint64_t x, unsigned r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t stateHash64(const void *data, size_t size, uint64_t seed) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    const size_t total = size;
+    uint64_t h;
+
+    if (size >= 32) {
+        uint64_t lanes[4] = {seed + PRIME1 + PRIME2, seed + PRIME2, seed,
+                             seed - PRIME1};
+        do {
+            for (unsigned k = 0; k < 4; k++) {
+                uint64_t word;
+                memcpy(&word, p + k * 8, 8);
+                lanes[k] = rotl64(lanes[k] + word * PRIME2, 31) * PRIME1;
+            }
+            p += 32;
+            size -= 32;
+        } while (size >= 32);
+
+        h = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) +
+            rotl64(lanes[3], 18);
+        for (unsigned k = 0; k < 4; k++) {
+            h = (h ^ (rotl64(lanes[k] * PRIME2, 31) * PRIME1)) * PRIME1 +
+                PRIME4;
+        }
+    } else {
+        h = seed + PRIME5;
+    }
+
+    h += total;
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = rotl64(h ^ (rotl64(word * PRIME2, 31) * PRIME1), 27) * PRIME1 +
+            PRIME4;
+        p += 8;
+        size -= 8;
+    }
+    while (size--) {
+        h = rotl64(h ^ (*p++ * PRIME5), 11) * PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Trace format: a header with the page count, then one record per frame.
+// Records have the register and output hashes, then a varint count of
+// changed pages, and a varint index and hash for each.
+static const uint8_t trace_magic[] = {'R', 'O', 'S', 'H'};
+static const uint8_t trace_version = 1;
+
+static void putVarint(std::vector<uint8_t> &out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(uint8_t(value));
+}
+
+static void putHash(std::vector<uint8_t> &out, uint64_t hash) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&hash);
+    out.insert(out.end(), bytes, bytes + sizeof hash);
+}
+
+StateHasher::StateHasher() { clear(); }
+
+void StateHasher::clear() {
+    trace.clear();
+    trace.insert(trace.end(), trace_magic, trace_magic + sizeof trace_magic);
+    trace.push_back(trace_version);
+    putVarint(trace, NUM_PAGES);
+    frames = 0;
+    memset(page_hashes, 0, sizeof page_hashes);
+    memset(&digest, 0, sizeof digest);
+}
+
+const StateHasher::Digest &StateHasher::push(Hardware &hw) {
+    // Registers and clock of whichever process is current
+    uint8_t regs[sizeof(SBTRegs) + sizeof(uint32_t)] = {};
+    uint64_t regs_seed = 0;
+    if (hw.process) {
+        uint32_t clock = hw.process->getClock();
+        memcpy(regs, &hw.process->reg, sizeof(SBTRegs));
+        memcpy(regs + sizeof(SBTRegs), &clock, sizeof clock);
+        const char *name = hw.process->getFilename();
+        regs_seed = stateHash64(name, strlen(name));
+    }
+    digest.regs = stateHash64(regs, sizeof regs, regs_seed);
+
+    // Pending output. Frame items have no meaningful value to hash, and
+    // frames shown depend on the output and frameskip, so only frames
+    // emulated are counted.
+    OutputState output;
+    hw.output.saveState(output);
+    uint32_t counters[2] = {output.emulated_frames,
+                            output.reference_timestamp};
+    uint64_t h = stateHash64(counters, sizeof counters);
+    for (const OutputItem &item : output.items) {
+        uint32_t words[2] = {item.otype,
+                             item.otype == OUT_CGA_FRAME ? 0 : item.u.delay};
+        h = stateHash64(words, sizeof words, h);
+    }
+    for (const CGAFramebuffer &frame : output.frames) {
+        h = stateHash64(frame.bytes, sizeof frame.bytes, h);
+    }
+    digest.output = h;
+
+    putHash(trace, digest.regs);
+    putHash(trace, digest.output);
+
+    // Memory pages that changed. Only pages written since the last push can
+    // have, and those are rehashed and kept if their hash differs.
+    const bool first = frames == 0;
+    uint8_t dirty[NUM_PAGES];
+    hw.getDirtyPages(Hardware::DIRTY_STATE_HASH, PAGE_SIZE, dirty);
+    hw.clearDirtyPages(Hardware::DIRTY_STATE_HASH);
+
+    uint16_t changed[NUM_PAGES];
+    unsigned num_changed = 0;
+    for (unsigned i = 0; i < NUM_PAGES; i++) {
+        if (first || dirty[i]) {
+            uint64_t h = stateHash64(hw.mem + i * PAGE_SIZE, PAGE_SIZE, i);
+            if (first || h != page_hashes[i]) {
+                page_hashes[i] = h;
+                changed[num_changed++] = i;
+            }
+        }
+    }
+    putVarint(trace, num_changed);
+    for (unsigned i = 0; i < num_changed; i++) {
+        putVarint(trace, changed[i]);
+        putHash(trace, page_hashes[changed[i]]);
+    }
+
+    digest.mem = stateHash64(page_hashes, sizeof page_hashes);
+    uint64_t parts[3] = {digest.mem, digest.regs, digest.output};
+    digest.total = stateHash64(parts, sizeof parts);
+
+    frames++;
+    return digest;
+}
+
+namespace {
+struct TraceReader {
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+    bool ok;
+
+    uint32_t num_pages;
+    uint64_t regs, output;
+    std::vector<uint64_t> pages;
+
+    TraceReader(const uint8_t *data, size_t size)
+        : data(data), size(size), offset(0), ok(true), num_pages(0), regs(0),
+          output(0) {
+        uint8_t magic[sizeof trace_magic];
+        bytes(magic, sizeof magic);
+        if (!ok || memcmp(magic, trace_magic, sizeof magic) ||
+            byte() != trace_version) {
+            ok = false;
+            return;
+        }
+        num_pages = varint();
+        if (num_pages > 0x10000) {
+            ok = false;
+        } else {
+            pages.resize(num_pages);
+        }
+    }
+
+    bool done() const { return !ok || offset >= size; }
+
+    uint8_t byte() {
+        if (offset >= size) {
+            ok = false;
+            return 0;
+        }
+        return data[offset++];
+    }
+
+    void bytes(void *dest, size_t count) {
+        if (count > size - offset) {
+            ok = false;
+            return;
+        }
+        memcpy(dest, data + offset, count);
+        offset += count;
+    }
+
+    uint32_t varint() {
+        uint32_t value = 0;
+        for (unsigned shift = 0; shift < 35; shift += 7) {
+            uint8_t b = byte();
+            value |= uint32_t(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                return value;
+            }
+        }
+        ok = false;
+        return 0;
+    }
+
+    uint64_t hash() {
+        uint64_t value = 0;
+        bytes(&value, sizeof value);
+        return value;
+    }
+
+    // Read the next frame, updating the page table
+    bool frame() {
+        regs = hash();
+        output = hash();
+        uint32_t count = varint();
+        for (uint32_t i = 0; ok && i < count; i++) {
+            uint32_t page = varint();
+            uint64_t value = hash();
+            if (page >= num_pages) {
+                ok = false;
+            } else {
+                pages[page] = value;
+            }
+        }
+        return ok;
+    }
+};
+} // namespace
+
+StateHasher::Divergence StateHasher::compare(const uint8_t *a, size_t a_size,
+                                             const uint8_t *b,
+                                             size_t b_size) {
+    TraceReader ra(a, a_size);
+    TraceReader rb(b, b_size);
+    Divergence result = {Divergence::NONE, 0, -1};
+
+    if (!ra.ok || !rb.ok || ra.num_pages != rb.num_pages) {
+        result.part = Divergence::MALFORMED;
+        return result;
+    }
+
+    for (;; result.frame++) {
+        if (ra.done() || rb.done()) {
+            if (!ra.ok || !rb.ok) {
+                result.part = Divergence::MALFORMED;
+            } else if (!ra.done() || !rb.done()) {
+                result.part = Divergence::LENGTH;
+            }
+            return result;
+        }
+        if (!ra.frame() || !rb.frame()) {
+            result.part = Divergence::MALFORMED;
+            return result;
+        }
+
+        // Memory first, since it's the most specific
+        for (uint32_t i = 0; i < ra.num_pages; i++) {
+            if (ra.pages[i] != rb.pages[i]) {
+                result.part = Divergence::MEM;
+                result.page = i;
+                return result;
+            }
+        }
+        if (ra.regs != rb.regs) {
+            result.part = Divergence::REGS;
+            return result;
+        }
+        if (ra.output != rb.output) {
+            result.part = Divergence::OUTPUT;
+            return result;
+        }
+    }
+}
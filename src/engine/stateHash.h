@@ -0,0 +1,64 @@
+#pragma once
+
+#include "hardware.h"
+#include <stdint.h>
+#include <vector>
+
+// Fast 64-bit hash in the style of xxHash64. The input is consumed as four
+// independent lanes of 64-bit words, which keeps the multipliers busy and
+// gives the compiler room to vectorize.
+uint64_t stateHash64(const void *data, size_t size, uint64_t seed = 0);
+
+// Per-frame digests of the machine state, for finding where two runs of the
+// same input diverge. Each push() hashes memory, the current process's
+// registers and clock, and pending output, and appends a record to a compact
+// trace. Memory is hashed in pages, and only pages that changed since the
+// previous push are written to the trace.
+//
+// Pages are only rehashed if the Hardware marked them dirty, using its
+// DIRTY_STATE_HASH bit. That bit belongs to the hasher, so use at most one
+// hasher per Hardware instance at a time, always pushing the same instance.
+class StateHasher {
+  public:
+    static constexpr unsigned PAGE_SIZE = 4096;
+    static constexpr unsigned NUM_PAGES = Hardware::MEM_SIZE / PAGE_SIZE;
+
+    struct Digest {
+        uint64_t mem;
+        uint64_t regs;
+        uint64_t output;
+        uint64_t total;
+    };
+
+    // Where two traces first differ
+    struct Divergence {
+        enum Part {
+            NONE,
+            MEM,
+            REGS,
+            OUTPUT,
+            LENGTH,
+            MALFORMED,
+        };
+        Part part;
+        uint32_t frame;
+        int page;
+    };
+
+    StateHasher();
+
+    void clear();
+    const Digest &push(Hardware &hw);
+
+    const std::vector<uint8_t> &getTrace() const { return trace; }
+    uint32_t getFrameCount() const { return frames; }
+
+    static Divergence compare(const uint8_t *a, size_t a_size,
+                              const uint8_t *b, size_t b_size);
+
+  private:
+    uint64_t page_hashes[NUM_PAGES];
+    std::vector<uint8_t> trace;
+    uint32_t frames;
+    Digest digest;
+};
@@ -0,0 +1,177 @@
+#include "thumbnailCache.h"
+#include "buildId.h" // Generated by the Makefile, for ENGINE_BUILD_ID
+#include "stateHash.h"
+#include <string.h>
+#include <utility>
+
+// Bumped when the blob layout changes
+static const uint8_t BLOB_VERSION = 1;
+
+ThumbnailCache::ThumbnailCache(size_t max_bytes)
+    : max_bytes(max_bytes), bytes(0), hits(0), misses(0), store(nullptr) {}
+
+void ThumbnailCache::setBudget(size_t budget) {
+    max_bytes = budget;
+    evict();
+}
+
+uint64_t ThumbnailCache::keyFor(const uint8_t *save, uint32_t size,
+                                unsigned width, unsigned height) {
+    static const uint64_t build =
+        stateHash64(ENGINE_BUILD_ID, strlen(ENGINE_BUILD_ID));
+    uint64_t seed = build ^ (uint64_t(width) << 32) ^ height;
+    return stateHash64(save, size, seed);
+}
+
+const ThumbnailCache::Entry *ThumbnailCache::find(uint64_t key) {
+    auto i = index.find(key);
+    if (i != index.end()) {
+        hits++;
+        entries.splice(entries.begin(), entries, i->second);
+        return &entries.front();
+    }
+
+    std::vector<uint8_t> blob;
+    Entry entry;
+    if (store && store->load(key, blob) && deserialize(blob, entry) &&
+        entry.key == key) {
+        hits++;
+        return add(entry);
+    }
+
+    misses++;
+    return nullptr;
+}
+
+const ThumbnailCache::Entry *
+ThumbnailCache::insert(uint64_t key, ROSavedGame *game, unsigned width,
+                       unsigned height, const uint32_t *pixels) {
+    Entry entry;
+    entry.key = key;
+    entry.is_game = game != nullptr;
+    memset(&entry.info, 0, sizeof entry.info);
+    if (game) {
+        game->getInfo(entry.info);
+    }
+    entry.width = width;
+    entry.height = height;
+    entry.pixels.assign(pixels, pixels + width * height);
+
+    if (store) {
+        std::vector<uint8_t> blob;
+        serialize(entry, blob);
+        store->save(key, blob);
+    }
+    return add(entry);
+}
+
+const ThumbnailCache::Entry *ThumbnailCache::add(Entry &entry) {
+    auto i = index.find(entry.key);
+    if (i != index.end()) {
+        bytes -= entryBytes(*i->second);
+        entries.erase(i->second);
+    }
+    bytes += entryBytes(entry);
+    entries.push_front(std::move(entry));
+    index[entries.front().key] = entries.begin();
+
+    // The newest entry is kept even if it's over budget on its own
+    evict();
+    return &entries.front();
+}
+
+void ThumbnailCache::evict() {
+    while (bytes > max_bytes && entries.size() > 1) {
+        bytes -= entryBytes(entries.back());
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+}
+
+size_t ThumbnailCache::entryBytes(const Entry &entry) {
+    return sizeof entry + entry.pixels.size() * sizeof entry.pixels[0];
+}
+
+static void putInt(std::vector<uint8_t> &blob, uint64_t value,
+                   unsigned count) {
+    for (unsigned i = 0; i < count; i++) {
+        blob.push_back(value >> (8 * i));
+    }
+}
+
+static uint64_t getInt(const uint8_t *&p, unsigned count) {
+    uint64_t value = 0;
+    for (unsigned i = 0; i < count; i++) {
+        value |= uint64_t(*(p++)) << (8 * i);
+    }
+    return value;
+}
+
+void ThumbnailCache::serialize(const Entry &entry, std::vector<uint8_t> &blob) {
+    // Little-endian fields, then the pixels. The world name is looked up
+    // again when loading, rather than stored.
+    const ROSaveInfo &info = entry.info;
+    blob.clear();
+    putInt(blob, BLOB_VERSION, 1);
+    putInt(blob, entry.key, 8);
+    putInt(blob, entry.is_game, 1);
+    putInt(blob, info.worldId, 1);
+    putInt(blob, info.playerRoom, 1);
+    putInt(blob, info.playerX, 1);
+    putInt(blob, info.playerY, 1);
+    putInt(blob, info.robotCount, 1);
+    for (unsigned i = 0; i < info.robotCount; i++) {
+        putInt(blob, info.robots[i].id, 1);
+        putInt(blob, info.robots[i].room, 1);
+        putInt(blob, info.robots[i].x, 1);
+        putInt(blob, info.robots[i].y, 1);
+    }
+    putInt(blob, entry.width, 2);
+    putInt(blob, entry.height, 2);
+    for (uint32_t pixel : entry.pixels) {
+        putInt(blob, pixel, 4);
+    }
+}
+
+bool ThumbnailCache::deserialize(const std::vector<uint8_t> &blob,
+                                 Entry &entry) {
+    const size_t header = 15;
+    const uint8_t *p = blob.data();
+    if (blob.size() < header || getInt(p, 1) != BLOB_VERSION) {
+        return false;
+    }
+
+    ROSaveInfo &info = entry.info;
+    entry.key = getInt(p, 8);
+    entry.is_game = getInt(p, 1);
+    info.worldId = getInt(p, 1);
+    info.worldName = ROSavedGame::getWorldName(info.worldId);
+    info.playerRoom = RORoomId(getInt(p, 1));
+    info.playerX = getInt(p, 1);
+    info.playerY = getInt(p, 1);
+    info.robotCount = getInt(p, 1);
+
+    const size_t robots_size = info.robotCount * 4;
+    if (info.robotCount > sizeof info.robots / sizeof info.robots[0] ||
+        blob.size() < header + robots_size + 4) {
+        return false;
+    }
+    for (unsigned i = 0; i < info.robotCount; i++) {
+        info.robots[i].id = RORobotId(getInt(p, 1));
+        info.robots[i].room = RORoomId(getInt(p, 1));
+        info.robots[i].x = getInt(p, 1);
+        info.robots[i].y = getInt(p, 1);
+    }
+
+    entry.width = getInt(p, 2);
+    entry.height = getInt(p, 2);
+    const size_t count = entry.width * entry.height;
+    if (blob.size() != header + robots_size + 4 + count * 4) {
+        return false;
+    }
+    entry.pixels.resize(count);
+    for (uint32_t &pixel : entry.pixels) {
+        pixel = getInt(p, 4);
+    }
+    return true;
+}
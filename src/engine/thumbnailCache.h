@@ -0,0 +1,70 @@
+#pragma once
+
+#include "roData.h"
+#include <list>
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+// Thumbnails and metadata for saved games, so the file manager doesn't run
+// the same save again every time it's opened. Entries are keyed by a hash
+// of the uncompressed save, the thumbnail size, and the engine build, since
+// a different build could draw the same save differently. The cache is
+// bounded in bytes, evicting the least recently used entries first.
+class ThumbnailCache {
+  public:
+    struct Entry {
+        uint64_t key;
+        bool is_game; // Chips have a thumbnail, but no info
+        ROSaveInfo info;
+        unsigned width;
+        unsigned height;
+        std::vector<uint32_t> pixels;
+    };
+
+    // Optional persistence, provided by the embedder. Blobs are opaque;
+    // entries are saved when inserted, and loaded on a miss.
+    class Store {
+      public:
+        virtual ~Store() {}
+        virtual bool load(uint64_t key, std::vector<uint8_t> &blob) = 0;
+        virtual void save(uint64_t key, const std::vector<uint8_t> &blob) = 0;
+    };
+
+    ThumbnailCache(size_t max_bytes);
+
+    void setStore(Store *s) { store = s; }
+    void setBudget(size_t max_bytes);
+
+    static uint64_t keyFor(const uint8_t *save, uint32_t size,
+                           unsigned width, unsigned height);
+
+    // Returns nullptr on a miss. Entries returned here stay valid until the
+    // next insert.
+    const Entry *find(uint64_t key);
+    const Entry *insert(uint64_t key, ROSavedGame *game, unsigned width,
+                        unsigned height, const uint32_t *pixels);
+
+    size_t getBytes() const { return bytes; }
+    size_t getCount() const { return entries.size(); }
+    uint64_t getHits() const { return hits; }
+    uint64_t getMisses() const { return misses; }
+
+  private:
+    // Most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+
+    size_t max_bytes;
+    size_t bytes;
+    uint64_t hits;
+    uint64_t misses;
+    Store *store;
+
+    const Entry *add(Entry &entry);
+    void evict();
+    static size_t entryBytes(const Entry &entry);
+    static void serialize(const Entry &entry, std::vector<uint8_t> &blob);
+    static bool deserialize(const std::vector<uint8_t> &blob, Entry &entry);
+};
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -5,30 +8,28 @@
 #define ZSTD_STATIC_LINKING_ONLY
 #include <zstd.h>
 
+#include "roData.h"
 #include "tinySave.h"
 
 // Versioning the save files, so we can change the compression
 // or otherwise break compatibility later.
 enum SaveVersion {
-    CURRENT_SAVE_VERSION = 0x11,
-    // Currently we only generate or support one version.
+    // Compressed with the dictionary below
+    PLAIN_SAVE_VERSION = 0x11,
+
+    // Followed by a world ID. The save is XOR'ed against the files that
+    // world starts from before compressing, leaving mostly zeroes.
+    DELTA_SAVE_VERSION = 0x12,
 };
 
-TinySave::TinySave() : size(0) {
+TinySave::TinySave()
+    : size(0), job_current(nullptr), baseline_world(-1), job_active(false) {
     initDictionary();
 
-    cctx = ZSTD_createCCtx();
-    ZSTD_CCtx_loadDictionary_advanced(cctx, &dict[0], dict.size(),
-                                      ZSTD_dlm_byRef, ZSTD_dct_rawContent);
-
-    ZSTD_CCtx_setParameter(cctx, ZSTD_c_contentSizeFlag, 0);
-    ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 0);
-    ZSTD_CCtx_setParameter(cctx, ZSTD_c_dictIDFlag, 0);
-
-    // Compression level is a CPU and memory vs space tradeoff.
-    // This can be changed without breaking format compatibility.
-    ZSTD_CCtx_setParameter(cctx, ZSTD_c_strategy, ZSTD_btultra2);
-    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, 18);
+    for (unsigned i = 0; i < NUM_LEVELS; i++) {
+        cctx[i] = nullptr;
+        job_cctx[i] = nullptr;
+    }
 
     dctx = ZSTD_createDCtx();
     ZSTD_DCtx_loadDictionary_advanced(dctx, &dict[0], dict.size(),
@@ -36,15 +37,218 @@ TinySave::TinySave() : size(0) {
 }
 
 TinySave::~TinySave() {
-    ZSTD_freeCCtx(cctx);
+    waitForJob();
+    for (unsigned i = 0; i < NUM_LEVELS; i++) {
+        ZSTD_freeCCtx(cctx[i]);
+        ZSTD_freeCCtx(job_cctx[i]);
+    }
     ZSTD_freeDCtx(dctx);
 }
 
-void TinySave::compress(const FileInfo &src) {
-    buffer[0] = CURRENT_SAVE_VERSION;
+ZSTD_CCtx *TinySave::getCompressor(ZSTD_CCtx **contexts, Level level) {
+    ZSTD_CCtx *ctx = contexts[level];
+    if (ctx) {
+        return ctx;
+    }
+
+    ctx = ZSTD_createCCtx();
+    ZSTD_CCtx_loadDictionary_advanced(ctx, &dict[0], dict.size(),
+                                      ZSTD_dlm_byRef, ZSTD_dct_rawContent);
+
+    ZSTD_CCtx_setParameter(ctx, ZSTD_c_contentSizeFlag, 0);
+    ZSTD_CCtx_setParameter(ctx, ZSTD_c_checksumFlag, 0);
+    ZSTD_CCtx_setParameter(ctx, ZSTD_c_dictIDFlag, 0);
+
+    // Compression level is a CPU and memory vs space tradeoff.
+    // This can be changed without breaking format compatibility.
+    if (level == FAST) {
+        ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, 3);
+    } else {
+        ZSTD_CCtx_setParameter(ctx, ZSTD_c_strategy, ZSTD_btultra2);
+        ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, 18);
+    }
+
+    contexts[level] = ctx;
+    return ctx;
+}
+
+void TinySave::compress(const FileInfo &src, Level level) {
+    uint32_t src_size = std::min<uint32_t>(src.size, sizeof scratch);
+    uint32_t header = encodeHeader(src.data, src_size, buffer, scratch);
     size_t result =
-        ZSTD_compress2(cctx, buffer + 1, sizeof buffer - 1, src.data, src.size);
-    size = ZSTD_isError(result) ? 0 : 1 + result;
+        ZSTD_compress2(getCompressor(cctx, level), buffer + header,
+                       sizeof buffer - header, scratch, src_size);
+    size = ZSTD_isError(result) ? 0 : header + result;
+}
+
+uint32_t TinySave::encodeHeader(const uint8_t *data, uint32_t data_size,
+                                uint8_t *header, uint8_t *residual) {
+    // Writes the version header, and the bytes to compress. Returns the
+    // header length.
+    memcpy(residual, data, data_size);
+
+    const std::vector<uint8_t> *base = nullptr;
+    if (data_size == sizeof(ROSavedGame)) {
+        const ROSavedGame *game = reinterpret_cast<const ROSavedGame *>(data);
+        base = getBaseline(game->worldId);
+    }
+    if (!base) {
+        header[0] = PLAIN_SAVE_VERSION;
+        return 1;
+    }
+
+    for (size_t i = 0; i < base->size(); i++) {
+        residual[i] ^= (*base)[i];
+    }
+    header[0] = DELTA_SAVE_VERSION;
+    header[1] = data[offsetof(ROSavedGame, worldId)];
+    return 2;
+}
+
+const std::vector<uint8_t> *TinySave::getBaseline(uint8_t world_id) {
+    // The starting files for each world, where they sit in a saved game.
+    // Like the dictionary, these must never change.
+
+    struct Part {
+        const char *file;
+        uint32_t offset;
+    };
+    static const Part sewer[] = {
+        {"sewer.wor", 0}, {"sewer.cir", sizeof(ROWorld)}, {nullptr, 0}};
+    static const Part subway[] = {{"subway.wld", 0}, {nullptr, 0}};
+    static const Part town[] = {{"town.wld", 0}, {nullptr, 0}};
+    static const Part comp[] = {{"comp.wld", 0}, {nullptr, 0}};
+    static const Part street[] = {{"street.wld", 0}, {nullptr, 0}};
+    static const Part lab[] = {{"lab.wor", 0}, {nullptr, 0}};
+
+    if (baseline_world == world_id) {
+        return &baseline;
+    }
+
+    const Part *parts;
+    switch (world_id) {
+    case RO_WORLD_SEWER:
+        parts = sewer;
+        break;
+    case RO_WORLD_SUBWAY:
+        parts = subway;
+        break;
+    case RO_WORLD_TOWN:
+        parts = town;
+        break;
+    case RO_WORLD_COMP:
+        parts = comp;
+        break;
+    case RO_WORLD_STREET:
+        parts = street;
+        break;
+    case RO_WORLD_LAB:
+        parts = lab;
+        break;
+    default:
+        return nullptr;
+    }
+
+    baseline.assign(sizeof(ROSavedGame), 0);
+    baseline_world = -1;
+    for (; parts->file; parts++) {
+        const FileInfo *file = FileInfo::lookup(parts->file);
+        if (!file) {
+            return nullptr;
+        }
+        uint32_t len = std::min<uint32_t>(file->size,
+                                          baseline.size() - parts->offset);
+        memcpy(&baseline[parts->offset], file->data, len);
+    }
+    baseline_world = world_id;
+    return &baseline;
+}
+
+bool TinySave::beginCompress(const uint8_t *data, uint32_t data_size,
+                             Level level) {
+    // Starting over would hand this job's result to whoever started the
+    // last one
+    if (job_active) {
+        return false;
+    }
+    job_current = getCompressor(job_cctx, level);
+    ZSTD_CCtx_reset(job_current, ZSTD_reset_session_only);
+
+    job_src_size = std::min<uint32_t>(data_size, sizeof job_src);
+    job_header = encodeHeader(data, job_src_size, job_dest, job_src);
+    ZSTD_CCtx_setPledgedSrcSize(job_current, job_src_size);
+    job_src_pos = 0;
+    job_out.dst = job_dest + job_header;
+    job_out.size = sizeof job_dest - job_header;
+    job_out.pos = 0;
+    job_failed = false;
+    job_active = true;
+
+#if TINY_SAVE_THREADS
+    job_done = false;
+    job_thread = std::thread(&TinySave::runJob, this);
+#endif
+    return true;
+}
+
+bool TinySave::continueCompress(uint32_t max_input_bytes) {
+    assert(job_active && "Continuing a compression job that isn't running");
+#if TINY_SAVE_THREADS
+    (void)max_input_bytes;
+    if (!job_done) {
+        return false;
+    }
+    job_thread.join();
+#else
+    if (!stepJob(max_input_bytes)) {
+        return false;
+    }
+#endif
+
+    job_active = false;
+    size = job_failed ? 0 : job_header + job_out.pos;
+    memcpy(buffer, job_dest, size);
+    return true;
+}
+
+bool TinySave::stepJob(size_t max_input_bytes) {
+    // Flushing after each slice ends a zstd block there, so each step does a
+    // bounded amount of work. Returns true once the frame is done or failed.
+    size_t end = job_src_size - job_src_pos <= max_input_bytes
+                     ? job_src_size
+                     : job_src_pos + max_input_bytes;
+    ZSTD_EndDirective mode = end == job_src_size ? ZSTD_e_end : ZSTD_e_flush;
+    ZSTD_inBuffer in = {job_src, end, job_src_pos};
+
+    size_t remaining;
+    do {
+        remaining = ZSTD_compressStream2(job_current, &job_out, &in, mode);
+    } while (!ZSTD_isError(remaining) && remaining &&
+             job_out.pos < job_out.size);
+    job_src_pos = in.pos;
+
+    if (ZSTD_isError(remaining) || remaining) {
+        job_failed = true;
+        return true;
+    }
+    return mode == ZSTD_e_end;
+}
+
+void TinySave::runJob() {
+#if TINY_SAVE_THREADS
+    while (!stepJob(SIZE_MAX)) {
+    }
+    job_done = true;
+#endif
+}
+
+void TinySave::waitForJob() {
+#if TINY_SAVE_THREADS
+    if (job_thread.joinable()) {
+        job_thread.join();
+    }
+#endif
+    job_active = false;
 }
 
 bool TinySave::decompress(FileInfo &dest) {
@@ -52,17 +256,36 @@ bool TinySave::decompress(FileInfo &dest) {
         // No version header
         return false;
     }
-    if (buffer[0] != CURRENT_SAVE_VERSION) {
+    if (buffer[0] != PLAIN_SAVE_VERSION && buffer[0] != DELTA_SAVE_VERSION) {
         // No other versions supported
         return false;
     }
+    const bool delta = buffer[0] == DELTA_SAVE_VERSION;
+    const uint32_t header = delta ? 2 : 1;
+    if (size < header) {
+        return false;
+    }
 
+    uint8_t *data = (uint8_t *)dest.data;
     size_t result =
-        ZSTD_decompressDCtx(dctx, (uint8_t *)dest.data,
-                            DOSFilesystem::MAX_FILESIZE, buffer + 1, size - 1);
+        ZSTD_decompressDCtx(dctx, data, DOSFilesystem::MAX_FILESIZE,
+                            buffer + header, size - header);
+    dest.size = 0;
+    if (ZSTD_isError(result)) {
+        return false;
+    }
 
-    dest.size = ZSTD_isError(result) ? 0 : result;
-    return !ZSTD_isError(result);
+    if (delta) {
+        const std::vector<uint8_t> *base = getBaseline(buffer[1]);
+        if (!base || result != base->size()) {
+            return false;
+        }
+        for (size_t i = 0; i < result; i++) {
+            data[i] ^= (*base)[i];
+        }
+    }
+    dest.size = result;
+    return true;
 }
 
 const std::vector<uint8_t> &TinySave::getCompressionDictionary() {
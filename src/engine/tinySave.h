@@ -4,24 +4,79 @@
 #include <vector>
 #include <zstd.h>
 
+// Emscripten only has working threads when built with -pthread
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#define TINY_SAVE_THREADS 1
+#include <atomic>
+#include <thread>
+#else
+#define TINY_SAVE_THREADS 0
+#endif
+
 // Holds a minified saved game file
 class TinySave {
   public:
     TinySave();
     ~TinySave();
 
+    // Levels only trade time for size, both decompress the same way
+    enum Level {
+        FAST,
+        SMALL,
+        NUM_LEVELS,
+    };
+
     uint8_t buffer[DOSFilesystem::MAX_FILESIZE];
     uint32_t size;
 
-    void compress(const FileInfo &src);
+    void compress(const FileInfo &src, Level level = SMALL);
     bool decompress(FileInfo &dest);
 
+    // Compression that doesn't block a frame, for autosaves. The source is
+    // copied, and the result lands in buffer once continueCompress() returns
+    // true. With threads the job runs in the background, otherwise each call
+    // compresses up to max_input_bytes more. There's one job at a time:
+    // beginCompress() returns false if one is still running, and
+    // continueCompress() may only be called while one is.
+    bool beginCompress(const uint8_t *data, uint32_t data_size, Level level);
+    bool continueCompress(uint32_t max_input_bytes);
+    bool isCompressing() const { return job_active; }
+
     const std::vector<uint8_t> &getCompressionDictionary();
 
   private:
-    ZSTD_CCtx *cctx;
+    // Compressors are per level, since each caches the dictionary tables
+    // it built on first use
+    ZSTD_CCtx *cctx[NUM_LEVELS];
+    ZSTD_CCtx *job_cctx[NUM_LEVELS];
+    ZSTD_CCtx *job_current;
     ZSTD_DCtx *dctx;
     std::vector<uint8_t> dict;
+    uint8_t scratch[DOSFilesystem::MAX_FILESIZE];
+
+    // Starting point for the most recently used world
+    std::vector<uint8_t> baseline;
+    int baseline_world;
+
+    bool job_active;
+    bool job_failed;
+    uint8_t job_src[DOSFilesystem::MAX_FILESIZE];
+    uint32_t job_src_size;
+    size_t job_src_pos;
+    uint8_t job_dest[DOSFilesystem::MAX_FILESIZE];
+    uint32_t job_header;
+    ZSTD_outBuffer job_out;
+#if TINY_SAVE_THREADS
+    std::thread job_thread;
+    std::atomic<bool> job_done;
+#endif
 
     void initDictionary();
+    const std::vector<uint8_t> *getBaseline(uint8_t world_id);
+    uint32_t encodeHeader(const uint8_t *data, uint32_t data_size,
+                          uint8_t *header, uint8_t *residual);
+    ZSTD_CCtx *getCompressor(ZSTD_CCtx **contexts, Level level);
+    bool stepJob(size_t max_input_bytes);
+    void runJob();
+    void waitForJob();
 };
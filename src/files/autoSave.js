@@ -13,39 +13,49 @@ let autosave_timer = null;
 // create so many saves that it's just clutter.
 const autosave_delay = 10000;
 
-export async function doAutoSave() {
+// Save files are compressed a slice at a time between frames, so autosaves
+// don't cause a visible hitch.
+const pack_slice_bytes = 4096;
+
+// The engine packs one save at a time, and packing yields between slices,
+// so each autosave waits for the one before it to finish
+let autosave_in_flight = Promise.resolve();
+
+// Share links are packed at the slower level, for a shorter URL. Either
+// way the save is packed once, for both the stored file and the window hash.
+export function doAutoSave(share_link = false) {
+    const result = autosave_in_flight.then(() => autoSaveNow(share_link));
+    autosave_in_flight = result.catch(() => {});
+    return result;
+}
+
+async function autoSaveNow(share_link) {
+    // Autosaves go to their own slot in the engine, leaving the user's save
+    // buffer and its write callback alone
     const engine = await EngineLoader.complete;
-    return await new Promise(function (resolve) {
-        // this is hacky... autosaves have a different
-        // completion action, and they shouldn't clobber
-        // the user's save buffer (it's especially annoying
-        // when loading chips), so I'm saving and restoring
-        // the callback and contents, for now. This could
-        // be improved by using a modified filename for the
-        // autosave, or otherwise asking the engine to use
-        // a different buffer than usual.
-        // fix me!
-
-        const saved_contents = engine.getSaveFile().slice();
-        const saved_callback = engine.onSaveFileWrite;
-        engine.onSaveFileWrite = function () {};
-
-        try {
-            const save_status = engine.saveGame();
-            const storage_status =
-                save_status === engine.SaveStatus.OK
-                    ? storeAutoSave(engine)
-                    : save_status;
-            if (storage_status === engine.SaveStatus.NOT_SUPPORTED) {
-                last_set_window_hash = '';
-                window.location.hash = '';
-            }
-            resolve(storage_status);
-        } finally {
-            engine.onSaveFileWrite = saved_callback;
-            engine.setSaveFile(saved_contents, false);
+    const save_status = engine.saveGameToSlot(engine.SaveSlot.AUTO);
+    const storage_status =
+        save_status === engine.SaveStatus.OK
+            ? await storeAutoSave(engine, share_link)
+            : save_status;
+    if (storage_status === engine.SaveStatus.NOT_SUPPORTED) {
+        last_set_window_hash = '';
+        window.location.hash = '';
+    }
+    return storage_status;
+}
+
+async function packAutoSave(engine, fast) {
+    if (!engine.startPackSaveFile(engine.SaveSlot.AUTO, fast)) {
+        throw new Error('Save file is already being packed');
+    }
+    for (;;) {
+        const packed = engine.continuePackSaveFile(pack_slice_bytes);
+        if (packed) {
+            return packed.slice();
         }
-    });
+        await new Promise((resolve) => setTimeout(resolve, 0));
+    }
 }
 
 async function checkHashForAutoSave() {
@@ -81,16 +91,17 @@ export function init() {
     checkHashForAutoSave();
 }
 
-function storeAutoSave(engine) {
-    const saveData = engine.getSaveFile();
-    const packed = engine.packSaveFile();
-
+async function storeAutoSave(engine, share_link) {
     const date = new Date();
-    const name = filenameForAutosave(saveData, date);
+    const name = filenameForAutosave(
+        engine.getSaveSlot(engine.SaveSlot.AUTO),
+        date,
+    );
     if (!name) {
         return engine.SaveStatus.NOT_SUPPORTED;
     }
 
+    const packed = await packAutoSave(engine, !share_link);
     engine.files.save(name, packed, date);
 
     const hash = base64.encode(packed);
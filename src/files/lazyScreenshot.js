@@ -6,28 +6,41 @@ import ScreenshotBrokenImage from '../assets/screenshot-broken.png';
 
 const render_stack = [];
 
+// Thumbnails are rendered at half size, and cropped like the game view
+const thumbnail_width = Graphics.WIDTH / 2;
+const thumbnail_height = Graphics.HEIGHT / 2;
+
 const render_canvas = document.createElement('canvas');
-render_canvas.width = Graphics.WIDTH;
-render_canvas.height = Graphics.VISIBLE_HEIGHT;
+render_canvas.width = thumbnail_width;
+render_canvas.height = Graphics.VISIBLE_HEIGHT / 2;
 
 function renderer() {
-    // Limit of one render per frame; keep coming back while the queue has work.
-    if (render_stack.length > 1) {
-        requestAnimationFrame(renderer);
-    }
-
-    const element = render_stack.pop();
-    const data = element._screenshot_data;
-    const file = data.loadedFile;
+    // Everything that became visible since the last frame renders in one
+    // batch, downscaled by the engine.
+    const elements = render_stack.splice(0);
+    const files = elements.map((element) => {
+        const file = element._screenshot_data.loadedFile;
+        return { data: file.data, compressed: isCompressed(file) };
+    });
 
     const engine = EngineLoader.instance;
-    const image = engine.screenshotSaveFile(file.data, isCompressed(file));
-    if (image) {
-        render_canvas.getContext('2d').putImageData(image, 0, 0);
-        element.src = render_canvas.toDataURL();
-    } else {
-        element.src = ScreenshotBrokenImage;
-    }
+    const thumbnails = engine.renderThumbnails(
+        files,
+        thumbnail_width,
+        thumbnail_height,
+    );
+    elements.forEach((element, i) => {
+        const thumbnail = thumbnails[i];
+        if (thumbnail) {
+            render_canvas.getContext('2d').putImageData(thumbnail.image, 0, 0);
+            element.src = render_canvas.toDataURL();
+            if (thumbnail.info) {
+                element.title = thumbnail.info.worldName;
+            }
+        } else {
+            element.src = ScreenshotBrokenImage;
+        }
+    });
 }
 
 async function thumbnailIsVisible(element) {
@@ -13,7 +13,7 @@ export function init() {
 
     const engine = EngineLoader.instance;
     engine.settings = new Settings(request);
-    engine.files = new Files(request, getStaticFiles());
+    engine.files = new Files(request, getStaticFileNames());
 }
 
 export function isCompressed(file) {
@@ -31,9 +31,16 @@ function getExtension(name) {
     return name.split('.').pop().toLowerCase();
 }
 
-async function getStaticFiles() {
+async function getStaticFileNames() {
     const engine = await EngineLoader.complete;
-    return engine.getStaticFiles();
+    return engine.getStaticFileNames();
+}
+
+async function loadStaticFile(file) {
+    // Static files are unpacked by the engine on first use
+    const engine = await EngineLoader.complete;
+    file.data = engine.getStaticFile(file.name);
+    return file;
 }
 
 function isHiddenFile(name) {
@@ -41,9 +48,9 @@ function isHiddenFile(name) {
 }
 
 class Files {
-    constructor(dbPromise, staticFilesPromise) {
+    constructor(dbPromise, staticNamesPromise) {
         this.dbPromise = dbPromise;
-        this.staticFilesPromise = staticFilesPromise;
+        this.staticNamesPromise = staticNamesPromise;
         this.maxFileSize = MAX_FILESIZE;
         this.allowedExtensions = 'gsv lsv csv gsvz lsvz'.split(' ');
     }
@@ -107,13 +114,13 @@ class Files {
         // this distinction matters) we want to present the built-in chips
         // quickly and consistently even if the db takes its time.
 
-        const staticFiles = await this.staticFilesPromise;
+        const staticNames = await this.staticNamesPromise;
         const date = new Date('1986-01-01T00:00:00.000Z');
 
-        for (const [name, data] of Object.entries(staticFiles)) {
+        for (const name of staticNames) {
             const extension = getExtension(name);
-            const file = { name, date, extension, data };
-            file.load = () => Promise.resolve(file);
+            const file = { name, date, extension };
+            file.load = () => loadStaticFile(file);
             fn(file);
         }
 
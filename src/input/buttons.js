@@ -224,7 +224,7 @@ export function init() {
     for (let button of document.getElementsByClassName('copy_url_btn')) {
         addButtonClick(button, async () => {
             const engine = await EngineLoader.complete;
-            const save_status = await AutoSave.doAutoSave();
+            const save_status = await AutoSave.doAutoSave(true);
             const href = window.location.href;
             switch (save_status) {
                 case engine.SaveStatus.OK:
@@ -46,6 +46,11 @@ export function audioContextSetup() {
         if (!global_context) {
             return false;
         }
+
+        // Have the engine synthesize at the device rate, so effects don't
+        // need resampling.
+        const rate = global_context.sampleRate;
+        EngineLoader.complete.then((engine) => engine.setAudioRate(rate));
     }
 
     if (global_context.state === 'suspended') {